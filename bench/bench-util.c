@@ -0,0 +1,32 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench-util.h"
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+double samples_percentile(double *samples, size_t count, double percentile) {
+  if (count == 0) {
+    return 0;
+  }
+
+  qsort(samples, count, sizeof(double), compare_doubles);
+
+  size_t idx = (size_t)(percentile / 100.0 * (count - 1) + 0.5);
+  return samples[idx];
+}
@@ -0,0 +1,12 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint64_t now_ns(void);
+
+// Sorts the samples in place
+double samples_percentile(double *samples, size_t count, double percentile);
+
+#endif // BENCH_UTIL_H
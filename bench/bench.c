@@ -0,0 +1,381 @@
+// End-to-end benchmark: drives the real editor functions over synthetic
+// workloads and prints one JSON object per measurement.
+
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench-util.h"
+#include "completion.h"
+#include "editor-io.h"
+#include "editor-operations.h"
+#include "editor.h"
+#include "file-io.h"
+#include "find.h"
+#include "loader.h"
+#include "memory.h"
+#include "pool.h"
+#include "row-operations.h"
+
+struct EditorConfig E;
+
+#define BENCH_SCREEN_ROWS 48
+#define BENCH_SCREEN_COLS 160
+
+// Results go to the real stdout, fd 1 is pointed at a scratch file so the
+// bytes of every frame written by editor_refresh_screen can be counted.
+static FILE *report;
+static char work_dir[] = "/tmp/kilo-bench-XXXXXX";
+static int scale = 1;
+
+static off_t frame_bytes_reset(void) {
+  off_t written = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+
+  if (ftruncate(STDOUT_FILENO, 0) == -1 ||
+      lseek(STDOUT_FILENO, 0, SEEK_SET) == -1) {
+    perror("frame buffer");
+    exit(EXIT_FAILURE);
+  }
+
+  return written;
+}
+
+static void report_op(const char *workload, const char *op, long iters,
+                      uint64_t ns) {
+  fprintf(report,
+          "{\"workload\":\"%s\",\"op\":\"%s\",\"iters\":%ld,"
+          "\"ns_per_op\":%.1f}\n",
+          workload, op, iters, (double)ns / iters);
+}
+
+static void report_frames(const char *workload, const char *op, long frames,
+                          uint64_t ns, off_t bytes) {
+  fprintf(report,
+          "{\"workload\":\"%s\",\"op\":\"%s\",\"iters\":%ld,"
+          "\"ns_per_op\":%.1f,\"bytes_per_frame\":%.1f}\n",
+          workload, op, frames, (double)ns / frames, (double)bytes / frames);
+}
+
+// Editor state
+
+static void bench_init_editor(void) {
+  E = (struct EditorConfig){
+      .screen_rows = BENCH_SCREEN_ROWS,
+      .screen_cols = BENCH_SCREEN_COLS,
+  };
+}
+
+static void bench_close_editor(void) {
+  for (int i = 0; i < E.num_rows; i++) {
+    editor_free_row(&E.row[i]);
+  }
+
+  mem_free(E.row);
+  free(E.filename);
+  bench_init_editor();
+}
+
+// Workload generators
+
+static char *workload_path(const char *name) {
+  char *path = malloc(strlen(work_dir) + strlen(name) + 2);
+  sprintf(path, "%s/%s", work_dir, name);
+
+  return path;
+}
+
+static void gen_huge_log(FILE *fp) {
+  static const char *levels[] = {"INFO ", "DEBUG", "WARN ", "INFO ", "ERROR"};
+  long lines = 200000L * scale;
+
+  for (long i = 0; i < lines; i++) {
+    fprintf(fp,
+            "2026-10-19T%02ld:%02ld:%02ld.%03ldZ %s [worker-%02ld] "
+            "request id=%08lx path=/api/v1/items/%ld status=%d "
+            "latency_ms=%ld\n",
+            (i / 3600000) % 24, (i / 60000) % 60, (i / 1000) % 60, i % 1000,
+            levels[i % 5], i % 16, i * 2654435761ul, i % 9973,
+            i % 97 ? 200 : 500, i % 250);
+  }
+}
+
+static void gen_minified(FILE *fp) {
+  static const char *chunk =
+      "var a=1,b=\"str\";function f(c){return c*2+a}if(b){a=f(3.14)}"
+      "for(var i=0;i<10;i++){a+=i}/*x*/";
+  size_t chunk_len = strlen(chunk);
+  int lines = 16 * scale;
+
+  for (int i = 0; i < lines; i++) {
+    for (size_t len = 0; len < 512 * 1024; len += chunk_len) {
+      fputs(chunk, fp);
+    }
+    fputc('\n', fp);
+  }
+}
+
+static void gen_commented_c(FILE *fp) {
+  long blocks = 20000L * scale;
+
+  for (long i = 0; i < blocks; i++) {
+    fprintf(fp,
+            "/*\n"
+            " * Function %ld: computes a value.\n"
+            " * It is documented at length to stress comment spans.\n"
+            " */\n"
+            "static int func_%ld(int x) {\n"
+            "\tif (x > %ld) {\n"
+            "\t\treturn x * 2; // double\n"
+            "\t}\n"
+            "\tchar *s = \"string %ld\";\n"
+            "\treturn (int)s[0] + %ld;\n"
+            "}\n\n",
+            i, i, i % 100, i, i);
+  }
+}
+
+// Operations
+
+// Times opening up to the last row being loaded, not just the first screen
+static void bench_open(const char *name, const char *path) {
+  uint64_t start = now_ns();
+  editor_open((char *)path);
+  while (loader_active()) {
+    usleep(100);
+    pool_drain();
+  }
+  report_op(name, "open", 1, now_ns() - start);
+}
+
+// Waits for the word index that opening started in the background, so it
+// doesn't compete with the operations timed after it
+static void bench_index(const char *name) {
+  uint64_t start = now_ns();
+  while (!completion_ready()) {
+    usleep(100);
+    pool_drain();
+  }
+  report_op(name, "index", 1, now_ns() - start);
+}
+
+static void bench_highlight(const char *name) {
+  uint64_t start = now_ns();
+  editor_select_syntax_highlight();
+  report_op(name, "highlight", 1, now_ns() - start);
+}
+
+static void bench_scroll(const char *name) {
+  long frames = E.num_rows < 2000 ? E.num_rows : 2000;
+  if (frames == 0) {
+    return;
+  }
+
+  // Cursor on the last screen line so that every step scrolls by one row
+  E.cursor_x = 0;
+  E.cursor_y = 0;
+  E.row_off = 0;
+  editor_refresh_screen();
+  frame_bytes_reset();
+
+  uint64_t start = now_ns();
+  for (long i = 0; i < frames; i++) {
+    E.cursor_y = i + E.screen_rows - 1;
+    if (E.cursor_y > E.num_rows) {
+      E.cursor_y = E.num_rows;
+    }
+
+    editor_refresh_screen();
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  report_frames(name, "scroll", frames, elapsed, frame_bytes_reset());
+}
+
+static void bench_typing(const char *name) {
+  long keys = 500;
+
+  E.cursor_y = E.num_rows / 2;
+  E.cursor_x = E.cursor_y < E.num_rows ? E.row[E.cursor_y].size / 2 : 0;
+  editor_refresh_screen();
+  frame_bytes_reset();
+
+  uint64_t start = now_ns();
+  for (long i = 0; i < keys; i++) {
+    editor_insert_char('a' + i % 26);
+    editor_refresh_screen();
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  report_frames(name, "typing", keys, elapsed, frame_bytes_reset());
+}
+
+static void bench_paste(const char *name) {
+  static const char *line = "\tpasted_line(value, \"text\", 42); // note";
+  int lines = 200;
+  long chars = 0;
+
+  E.cursor_y = E.num_rows;
+  E.cursor_x = 0;
+
+  // A terminal paste arrives as a stream of single keys
+  uint64_t start = now_ns();
+  for (int i = 0; i < lines; i++) {
+    for (const char *c = line; *c; c++, chars++) {
+      editor_insert_char(*c);
+    }
+
+    editor_insert_new_line();
+    chars++;
+  }
+  editor_refresh_screen();
+  uint64_t elapsed = now_ns() - start;
+  frame_bytes_reset();
+
+  report_op(name, "paste", chars, elapsed);
+}
+
+static void bench_search(const char *name, const char *query) {
+  char buf[64];
+  size_t query_len = strlen(query);
+  long calls = 0;
+
+  E.cursor_x = 0;
+  E.cursor_y = 0;
+  E.row_off = 0;
+
+  uint64_t start = now_ns();
+  for (size_t i = 1; i <= query_len; i++, calls++) {
+    memcpy(buf, query, i);
+    buf[i] = '\0';
+    editor_find_callback(buf, query[i - 1]);
+  }
+
+  for (int i = 0; i < 100; i++, calls++) {
+    editor_find_callback(buf, ARROW_DOWN);
+  }
+
+  editor_find_callback(buf, '\r');
+  calls++;
+  uint64_t elapsed = now_ns() - start;
+
+  report_op(name, "search", calls, elapsed);
+}
+
+static void bench_save(const char *name) {
+  uint64_t start = now_ns();
+  editor_save();
+  report_op(name, "save", 1, now_ns() - start);
+}
+
+// Each workload runs in its own process so that its peak RSS is isolated.
+
+struct Workload {
+  const char *name;
+  const char *file;
+  void (*generate)(FILE *fp);
+  const char *query;
+};
+
+static void run_workload(const struct Workload *w) {
+  char *path = workload_path(w->file);
+
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  w->generate(fp);
+  fclose(fp);
+
+  fflush(report);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+
+  if (pid == 0) {
+    bench_init_editor();
+
+    bench_open(w->name, path);
+    bench_index(w->name);
+    bench_highlight(w->name);
+    bench_scroll(w->name);
+    bench_search(w->name, w->query);
+    bench_typing(w->name);
+    bench_paste(w->name);
+    bench_save(w->name);
+
+    bench_close_editor();
+    fflush(report);
+    _exit(EXIT_SUCCESS);
+  }
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) == -1 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != EXIT_SUCCESS) {
+    fprintf(stderr, "bench: workload %s failed\n", w->name);
+    exit(EXIT_FAILURE);
+  }
+
+  struct stat st;
+  stat(path, &st);
+  fprintf(report,
+          "{\"workload\":\"%s\",\"file_bytes\":%lld,\"peak_rss_kb\":%ld}\n",
+          w->name, (long long)st.st_size, usage.ru_maxrss);
+
+  unlink(path);
+  free(path);
+}
+
+int main(void) {
+  static const struct Workload workloads[] = {
+      {"huge_log", "huge.log", gen_huge_log, "status=500"},
+      {"minified", "minified.c", gen_minified, "return"},
+      {"commented_c", "commented.c", gen_commented_c, "func_1999"},
+  };
+
+  const char *env_scale = getenv("KILO_BENCH_SCALE");
+  if (env_scale && atoi(env_scale) > 0) {
+    scale = atoi(env_scale);
+  }
+
+  if (mkdtemp(work_dir) == NULL) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+
+  int report_fd = dup(STDOUT_FILENO);
+  report = fdopen(report_fd, "w");
+
+  char *frames_path = workload_path("frames");
+  int frames_fd = open(frames_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (report == NULL || frames_fd == -1 ||
+      dup2(frames_fd, STDOUT_FILENO) == -1) {
+    perror("bench");
+    return EXIT_FAILURE;
+  }
+  close(frames_fd);
+
+  for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+    run_workload(&workloads[i]);
+  }
+
+  unlink(frames_path);
+  free(frames_path);
+  rmdir(work_dir);
+  fclose(report);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+// Microbenchmarks for the row-operation and render kernels. Every kernel
+// runs in a tight loop over a grid of row lengths and tab densities and
+// prints one JSON object per configuration with median and p99 ns/op.
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "append_buffer.h"
+#include "bench-util.h"
+#include "editor-io.h"
+#include "editor.h"
+#include "memory.h"
+#include "row-operations.h"
+
+struct EditorConfig E;
+
+#define MICRO_WARMUP_NS 20000000ull
+#define MICRO_SAMPLE_NS 20000ull
+#define MICRO_SAMPLES 200
+
+#define MICRO_SCREEN_ROWS 48
+#define MICRO_SCREEN_COLS 160
+
+static const int row_lengths[] = {16, 80, 256, 4096, 65536};
+static const double tab_densities[] = {0.0, 0.03, 0.125, 0.5};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+static volatile int sink;
+
+// Runner
+
+typedef void (*KernelFn)(void *ctx);
+
+static uint64_t time_batch(KernelFn fn, void *ctx, long batch) {
+  uint64_t start = now_ns();
+  for (long i = 0; i < batch; i++) {
+    fn(ctx);
+  }
+
+  return now_ns() - start;
+}
+
+// ops_per_call divides the time of one call for kernels that batch work
+static void run_kernel(const char *kernel, int row_len, double tab_density,
+                       KernelFn fn, void *ctx, long ops_per_call) {
+  uint64_t warmup_start = now_ns();
+  while (now_ns() - warmup_start < MICRO_WARMUP_NS) {
+    fn(ctx);
+  }
+
+  // Grow the batch until one sample is long enough to time reliably
+  long batch = 1;
+  while (time_batch(fn, ctx, batch) < MICRO_SAMPLE_NS && batch < (1L << 24)) {
+    batch *= 2;
+  }
+
+  double samples[MICRO_SAMPLES];
+  for (int i = 0; i < MICRO_SAMPLES; i++) {
+    samples[i] =
+        (double)time_batch(fn, ctx, batch) / ((double)batch * ops_per_call);
+  }
+
+  double median = samples_percentile(samples, MICRO_SAMPLES, 50);
+  double p99 = samples_percentile(samples, MICRO_SAMPLES, 99);
+
+  printf("{\"kernel\":\"%s\",\"row_len\":%d,\"tab_density\":%.3f,"
+         "\"batch\":%ld,\"median_ns\":%.1f,\"p99_ns\":%.1f}\n",
+         kernel, row_len, tab_density, batch, median, p99);
+  fflush(stdout);
+}
+
+// Fixtures
+
+static char *make_row_text(int len, double tab_density) {
+  static const char *pattern = "if (x > 10) { return \"str\" + 42; } /* c */ ";
+  size_t pattern_len = strlen(pattern);
+
+  char *text = mem_malloc(MEM_ROW_TEXT, len + 1);
+  for (int i = 0; i < len; i++) {
+    int tab = (int)((i + 1) * tab_density) != (int)(i * tab_density);
+    text[i] = tab ? '\t' : pattern[i % pattern_len];
+  }
+  text[len] = '\0';
+
+  return text;
+}
+
+static void fill_row(EditorRow *row, int idx, int len, double tab_density) {
+  *row = (EditorRow){.idx = idx, .size = len};
+  row->chars = make_row_text(len, tab_density);
+  editor_update_row(row);
+}
+
+static void use_syntax(int enabled) {
+  E.filename = enabled ? "micro.c" : NULL;
+  editor_select_syntax_highlight();
+}
+
+// Kernels
+
+static void kernel_update_render(void *ctx) { editor_update_render(ctx); }
+
+static void kernel_update_row(void *ctx) { editor_update_row(ctx); }
+
+static void kernel_update_syntax(void *ctx) { editor_update_syntax(ctx); }
+
+static void kernel_cx_to_rx(void *ctx) {
+  EditorRow *row = ctx;
+  sink = editor_row_cursor_x_to_render_x(row, row->size);
+}
+
+// Builds one frame out of chunk-sized appends
+struct AppendCtx {
+  char *chunk;
+  int chunk_len;
+  int appends;
+};
+
+static void kernel_ab_append(void *ctx) {
+  struct AppendCtx *a = ctx;
+  struct abuf ab = ABUF_INIT;
+
+  for (int i = 0; i < a->appends; i++) {
+    ab_append(&ab, a->chunk, a->chunk_len);
+  }
+
+  sink = ab.len;
+  ab_free(&ab);
+}
+
+static void kernel_draw_rows(void *ctx) {
+  (void)ctx;
+  struct abuf ab = ABUF_INIT;
+
+  editor_draw_rows(&ab);
+
+  sink = ab.len;
+  ab_free(&ab);
+}
+
+// Suites
+
+static void bench_row_kernels(void) {
+  for (size_t i = 0; i < ARRAY_LEN(row_lengths); i++) {
+    for (size_t j = 0; j < ARRAY_LEN(tab_densities); j++) {
+      int len = row_lengths[i];
+      double density = tab_densities[j];
+
+      EditorRow row;
+      E.row = &row;
+      E.num_rows = 1;
+
+      // Tab expansion alone, then a whole unchanged update: the render plus
+      // the compare for the word index, the line map and a highlighter that
+      // only clears without a syntax
+      use_syntax(0);
+      fill_row(&row, 0, len, density);
+      run_kernel("update_render", len, density, kernel_update_render, &row,
+                 1);
+      run_kernel("update_row", len, density, kernel_update_row, &row, 1);
+
+      use_syntax(1);
+      editor_update_row(&row);
+      run_kernel("update_syntax", len, density, kernel_update_syntax, &row,
+                 1);
+      run_kernel("cursor_x_to_render_x", len, density, kernel_cx_to_rx, &row,
+                 1);
+
+      editor_free_row(&row);
+    }
+  }
+}
+
+static void bench_ab_append(void) {
+  // Chunk sizes of escape sequences, single glyphs and whole screen lines
+  static const int chunk_lengths[] = {1, 3, 5, 16, 160};
+  const int frame_bytes = MICRO_SCREEN_ROWS * MICRO_SCREEN_COLS;
+
+  for (size_t i = 0; i < ARRAY_LEN(chunk_lengths); i++) {
+    struct AppendCtx ctx = {
+        .chunk = make_row_text(chunk_lengths[i], 0),
+        .chunk_len = chunk_lengths[i],
+        .appends = frame_bytes / chunk_lengths[i],
+    };
+
+    run_kernel("ab_append", ctx.chunk_len, 0, kernel_ab_append, &ctx,
+               ctx.appends);
+
+    mem_free(ctx.chunk);
+  }
+}
+
+static void bench_draw_rows(void) {
+  EditorRow rows[MICRO_SCREEN_ROWS];
+
+  E.num_rows = 0;
+  use_syntax(1);
+  E.row = rows;
+  E.num_rows = MICRO_SCREEN_ROWS;
+
+  for (size_t i = 0; i < ARRAY_LEN(row_lengths); i++) {
+    for (size_t j = 0; j < ARRAY_LEN(tab_densities); j++) {
+      for (int y = 0; y < MICRO_SCREEN_ROWS; y++) {
+        fill_row(&rows[y], y, row_lengths[i], tab_densities[j]);
+      }
+
+      run_kernel("draw_rows", row_lengths[i], tab_densities[j],
+                 kernel_draw_rows, NULL, 1);
+
+      for (int y = 0; y < MICRO_SCREEN_ROWS; y++) {
+        editor_free_row(&rows[y]);
+      }
+    }
+  }
+}
+
+int main(void) {
+  E = (struct EditorConfig){
+      .screen_rows = MICRO_SCREEN_ROWS,
+      .screen_cols = MICRO_SCREEN_COLS,
+  };
+
+  bench_row_kernels();
+  bench_ab_append();
+  bench_draw_rows();
+
+  return EXIT_SUCCESS;
+}
@@ -4,9 +4,10 @@
 #include <string.h>
 
 #include "append_buffer.h"
+#include "memory.h"
 
 void ab_append(struct abuf *ab, const char *s, int len) {
-  char *new_buffer = realloc(ab->buffer, ab->len + len);
+  char *new_buffer = mem_realloc(MEM_FRAME, ab->buffer, ab->len + len);
 
   if (new_buffer == NULL) {
     return;
@@ -19,7 +20,7 @@ void ab_append(struct abuf *ab, const char *s, int len) {
 }
 
 void ab_free(struct abuf *ab) {
-  free(ab->buffer);
+  mem_free(ab->buffer);
   ab->buffer = NULL;
   ab->len = 0;
 }
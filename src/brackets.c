@@ -0,0 +1,436 @@
+#include <limits.h>
+#include <string.h>
+
+#include "brackets.h"
+#include "dirty.h"
+#include "editor-io.h"
+#include "editor.h"
+#include "memory.h"
+#include "row-operations.h"
+#include "treap.h"
+
+extern struct EditorConfig E;
+
+struct Bracket {
+  int rx;
+  char c;
+};
+
+// Opening brackets count +1 and closing ones -1. Sums of a run of rows
+// keep the lowest prefix and highest suffix of those counts, both at least
+// as extreme as 0 for the empty run.
+struct BracketSums {
+  int sum;
+  int min_prefix;
+  int max_suffix;
+};
+
+// One tree node per row, in row order, with the sums of its row and of its
+// subtree
+struct BracketNode {
+  struct BracketSums row;
+  struct BracketSums all;
+};
+
+static void brackets_pull(int t);
+static void brackets_grow(int cap);
+
+static struct BracketNode *nodes = NULL;
+static struct Treap tree = {
+    .num_nodes = 1,
+    .seed = 2463534242u,
+    .tag = MEM_HIGHLIGHT,
+    .pull = brackets_pull,
+    .grow = brackets_grow,
+};
+
+// Rows whose brackets must be collected again from their highlight
+static struct DirtyRanges stale;
+
+// The bracket at the cursor and its match, row -1 if there is none
+static int match_row[2] = {-1, -1};
+static int match_rx[2];
+
+static int bracket_value(char c) {
+  switch (c) {
+  case '(':
+  case '[':
+  case '{':
+    return 1;
+  case ')':
+  case ']':
+  case '}':
+    return -1;
+  default:
+    return 0;
+  }
+}
+
+static int brackets_pair(char open, char close) {
+  return (open == '(' && close == ')') || (open == '[' && close == ']') ||
+         (open == '{' && close == '}');
+}
+
+// Rows
+
+// Only touches the row, so rows not in E yet may be collected on a worker
+// thread
+void brackets_collect_row(EditorRow *row) {
+  // A deferred row has none until it is lexed, which marks it stale again
+  int size = row->hl ? row->r_size : 0;
+
+  int count = 0;
+  for (int i = 0; i < size; i++) {
+    count += row->hl[i] == HL_NORMAL && bracket_value(row->r_chars[i]);
+  }
+
+  mem_free(row->brackets);
+  row->brackets =
+      count ? mem_malloc(MEM_HIGHLIGHT, sizeof(struct Bracket) * count) : NULL;
+  row->num_brackets = 0;
+
+  for (int i = 0; i < size && row->num_brackets < count; i++) {
+    if (row->hl[i] == HL_NORMAL && bracket_value(row->r_chars[i])) {
+      row->brackets[row->num_brackets++] =
+          (struct Bracket){.rx = i, .c = row->r_chars[i]};
+    }
+  }
+}
+
+static struct BracketSums brackets_leaf(EditorRow *row) {
+  struct BracketSums leaf = {0};
+
+  for (int i = 0; i < row->num_brackets; i++) {
+    leaf.sum += bracket_value(row->brackets[i].c);
+    if (leaf.sum < leaf.min_prefix) {
+      leaf.min_prefix = leaf.sum;
+    }
+  }
+
+  int suffix = 0;
+  for (int i = row->num_brackets - 1; i >= 0; i--) {
+    suffix += bracket_value(row->brackets[i].c);
+    if (suffix > leaf.max_suffix) {
+      leaf.max_suffix = suffix;
+    }
+  }
+
+  return leaf;
+}
+
+// Tree
+
+// Sums of run a followed by run b
+static struct BracketSums brackets_join(struct BracketSums a,
+                                        struct BracketSums b) {
+  int prefix = a.sum + b.min_prefix;
+  int suffix = b.sum + a.max_suffix;
+
+  return (struct BracketSums){
+      .sum = a.sum + b.sum,
+      .min_prefix = a.min_prefix < prefix ? a.min_prefix : prefix,
+      .max_suffix = b.max_suffix > suffix ? b.max_suffix : suffix,
+  };
+}
+
+static void brackets_pull(int t) {
+  struct TreapNode *n = &tree.nodes[t];
+
+  nodes[t].all = brackets_join(brackets_join(nodes[n->left].all, nodes[t].row),
+                               nodes[n->right].all);
+}
+
+static void brackets_grow(int cap) {
+  nodes = mem_realloc(MEM_HIGHLIGHT, nodes, sizeof(struct BracketNode) * cap);
+  nodes[0] = (struct BracketNode){0};
+}
+
+// Gives node t the brackets of row *arg + i. Rows not in E yet have none,
+// and the stale ones get theirs with the next refresh.
+static void brackets_fill(int t, int i, void *arg) {
+  int row = *(int *)arg + i;
+
+  nodes[t] = (struct BracketNode){0};
+  if (row < E.num_rows) {
+    nodes[t].row = brackets_leaf(&E.row[row]);
+  }
+}
+
+// Collects the stale rows and brings the tree up to date with them. Rows
+// the loader appended since join it at the end as one balanced piece.
+static void brackets_refresh(void) {
+  int rows = treap_size(&tree, tree.root);
+  if (rows > E.num_rows) {
+    treap_free_tree(&tree, tree.root);
+    treap_set_root(&tree, 0);
+    rows = 0;
+  }
+  if (rows < E.num_rows) {
+    int added = treap_build(&tree, E.num_rows - rows, brackets_fill, &rows);
+    treap_set_root(&tree, treap_merge(&tree, tree.root, added));
+  }
+
+  for (int i = 0; i < stale.count; i++) {
+    int end =
+        stale.ranges[i].end < E.num_rows ? stale.ranges[i].end : E.num_rows;
+
+    for (int row = stale.ranges[i].start; row < end; row++) {
+      int t = treap_node_at(&tree, row);
+
+      brackets_collect_row(&E.row[row]);
+      nodes[t].row = brackets_leaf(&E.row[row]);
+      treap_pull_up(&tree, t);
+    }
+  }
+  dirty_clear(&stale);
+}
+
+void brackets_rows_changed(int start, int end) {
+  dirty_add(&stale, start, end);
+}
+
+// Rows past the tree's last one are still to be appended, and those
+// inserted or deleted among them are left to that
+void brackets_rows_inserted(int at, int count) {
+  dirty_shift(&stale, at, count);
+  dirty_add(&stale, at, at + count);
+
+  if (at > treap_size(&tree, tree.root)) {
+    return;
+  }
+
+  // Stale, their brackets come with the next refresh
+  int none = E.num_rows;
+  int added = treap_build(&tree, count, brackets_fill, &none);
+
+  int a, b;
+  treap_split(&tree, tree.root, at, &a, &b);
+  treap_set_root(&tree, treap_merge(&tree, treap_merge(&tree, a, added), b));
+}
+
+void brackets_rows_deleted(int at, int count) {
+  dirty_shift(&stale, at, -count);
+
+  if (at >= treap_size(&tree, tree.root)) {
+    return;
+  }
+
+  int a, b, gone;
+  treap_split(&tree, tree.root, at, &a, &b);
+  treap_split(&tree, b, count, &gone, &b);
+  treap_free_tree(&tree, gone);
+  treap_set_root(&tree, treap_merge(&tree, a, b));
+}
+
+// First row at or after from where a depth that starts at *depth drops
+// below 0, -1 if none. *depth is what the rows before it leave. offset is
+// the first row of t.
+static int brackets_forward(int t, int offset, int from, int *depth) {
+  struct TreapNode *n = &tree.nodes[t];
+  struct BracketNode *sums = &nodes[t];
+  if (t == 0 || offset + n->size <= from) {
+    return -1;
+  }
+  if (offset >= from && *depth + sums->all.min_prefix >= 0) {
+    *depth += sums->all.sum;
+    return -1;
+  }
+
+  int row = brackets_forward(n->left, offset, from, depth);
+  if (row != -1) {
+    return row;
+  }
+
+  int self = offset + treap_size(&tree, n->left);
+  if (self >= from) {
+    if (*depth + sums->row.min_prefix < 0) {
+      return self;
+    }
+    *depth += sums->row.sum;
+  }
+
+  return brackets_forward(n->right, self + 1, from, depth);
+}
+
+// Last row before to where a count of unmatched closing brackets that
+// starts at *depth drops below 0 going up, -1 if none
+static int brackets_backward(int t, int offset, int to, int *depth) {
+  struct TreapNode *n = &tree.nodes[t];
+  struct BracketNode *sums = &nodes[t];
+  if (t == 0 || offset >= to) {
+    return -1;
+  }
+  if (offset + n->size <= to && *depth - sums->all.max_suffix >= 0) {
+    *depth -= sums->all.sum;
+    return -1;
+  }
+
+  int self = offset + treap_size(&tree, n->left);
+  int row = brackets_backward(n->right, self + 1, to, depth);
+  if (row != -1) {
+    return row;
+  }
+
+  if (self < to) {
+    if (*depth - sums->row.max_suffix < 0) {
+      return self;
+    }
+    *depth -= sums->row.sum;
+  }
+
+  return brackets_backward(n->left, offset, to, depth);
+}
+
+// Finds the bracket matching bracket i of row. Only the two rows at the
+// ends are scanned, the ones in between are skipped through the tree.
+static int brackets_find_match(int row, int i, int *match_i) {
+  struct Bracket *b = &E.row[row].brackets[i];
+  int dir = bracket_value(b->c);
+  int depth = 0;
+
+  for (int j = i + dir; j >= 0 && j < E.row[row].num_brackets; j += dir) {
+    depth += bracket_value(E.row[row].brackets[j].c) * dir;
+    if (depth < 0) {
+      *match_i = j;
+      return row;
+    }
+  }
+
+  int found = dir > 0
+                  ? brackets_forward(tree.root, 0, row + 1, &depth)
+                  : brackets_backward(tree.root, 0, row, &depth);
+  if (found == -1 || found >= E.num_rows) {
+    return -1;
+  }
+
+  EditorRow *r = &E.row[found];
+  int start = dir > 0 ? 0 : r->num_brackets - 1;
+  for (int j = start; j >= 0 && j < r->num_brackets; j += dir) {
+    depth += bracket_value(r->brackets[j].c) * dir;
+    if (depth < 0) {
+      *match_i = j;
+      return found;
+    }
+  }
+
+  return -1;
+}
+
+// Row of the bracket closing the last one row leaves open, -1 if none
+int brackets_block_end(int row) {
+  brackets_refresh();
+
+  EditorRow *r = &E.row[row];
+  int depth = 0;
+
+  for (int i = r->num_brackets - 1; i >= 0; i--) {
+    depth -= bracket_value(r->brackets[i].c);
+    if (depth < 0) {
+      int j;
+      int match = brackets_find_match(row, i, &j);
+      return match >= 0 && brackets_pair(r->brackets[i].c,
+                                         E.row[match].brackets[j].c)
+                 ? match
+                 : -1;
+    }
+  }
+
+  return -1;
+}
+
+// Index of the bracket at render position rx of row, or right before it
+static int brackets_at(EditorRow *row, int rx) {
+  for (int i = row->num_brackets - 1; i >= 0; i--) {
+    if (row->brackets[i].rx == rx) {
+      return i;
+    }
+    if (row->brackets[i].rx == rx - 1) {
+      return i;
+    }
+    if (row->brackets[i].rx < rx - 1) {
+      break;
+    }
+  }
+
+  return -1;
+}
+
+static void brackets_set_match(int row_a, int rx_a, int row_b, int rx_b) {
+  for (int i = 0; i < 2; i++) {
+    if (match_row[i] >= 0) {
+      dirty_add(&E.dirty_since_frame, match_row[i], match_row[i] + 1);
+    }
+  }
+
+  match_row[0] = row_a;
+  match_rx[0] = rx_a;
+  match_row[1] = row_b;
+  match_rx[1] = rx_b;
+
+  for (int i = 0; i < 2; i++) {
+    if (match_row[i] >= 0) {
+      dirty_add(&E.dirty_since_frame, match_row[i], match_row[i] + 1);
+    }
+  }
+}
+
+// Looks up the pair of brackets at the cursor, called before every frame
+void brackets_update_match(void) {
+  brackets_refresh();
+
+  int row_a = -1, rx_a = 0, row_b = -1, rx_b = 0;
+
+  if (E.cursor_y < E.num_rows) {
+    EditorRow *row = &E.row[E.cursor_y];
+    int i = brackets_at(row, E.render_x);
+
+    int j;
+    int match = i >= 0 ? brackets_find_match(E.cursor_y, i, &j) : -1;
+
+    if (match >= 0) {
+      char c = row->brackets[i].c;
+      char other = E.row[match].brackets[j].c;
+
+      // A ( closed by ] has no match
+      if (bracket_value(c) > 0 ? brackets_pair(c, other)
+                               : brackets_pair(other, c)) {
+        row_a = E.cursor_y;
+        rx_a = row->brackets[i].rx;
+        row_b = match;
+        rx_b = E.row[match].brackets[j].rx;
+      }
+    }
+  }
+
+  if (row_a != match_row[0] || rx_a != match_rx[0] || row_b != match_row[1] ||
+      rx_b != match_rx[1]) {
+    brackets_set_match(row_a, rx_a, row_b, rx_b);
+  }
+}
+
+// Render position of the next highlighted bracket in row from from_rx on,
+// INT_MAX if there is none
+int brackets_next_highlight(int row, int from_rx) {
+  int next = INT_MAX;
+
+  for (int i = 0; i < 2; i++) {
+    if (match_row[i] == row && match_rx[i] >= from_rx && match_rx[i] < next) {
+      next = match_rx[i];
+    }
+  }
+
+  return next;
+}
+
+void editor_jump_to_bracket(void) {
+  brackets_update_match();
+
+  if (match_row[0] == -1) {
+    editor_set_status_message("No matching bracket");
+    return;
+  }
+
+  E.cursor_y = match_row[1];
+  E.cursor_x = editor_row_render_x_to_cursor_x(&E.row[match_row[1]],
+                                               match_rx[1]);
+}
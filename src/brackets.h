@@ -0,0 +1,19 @@
+#ifndef BRACKETS_H
+#define BRACKETS_H
+
+#include "editor.h"
+
+// Brackets outside strings and comments, indexed so the one matching any
+// bracket is found in O(log n) rows
+
+void brackets_collect_row(EditorRow *row);
+void brackets_rows_changed(int start, int end);
+void brackets_rows_inserted(int at, int count);
+void brackets_rows_deleted(int at, int count);
+
+int brackets_block_end(int row);
+void brackets_update_match(void);
+int brackets_next_highlight(int row, int from_rx);
+void editor_jump_to_bracket(void);
+
+#endif // BRACKETS_H
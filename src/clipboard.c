@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "clipboard.h"
+#include "editor-io.h"
+#include "editor-operations.h"
+#include "editor.h"
+#include "memory.h"
+#include "row-operations.h"
+#include "selection.h"
+
+extern struct EditorConfig E;
+
+// What was copied. Copying only notes the selection, the text is read from
+// the rows themselves until an edit is about to change one of them, and
+// only then copied out, once and as a whole. Copying costs the same at any
+// size, and pasting copies each byte straight into its new row.
+static struct Selection region;
+static int referencing = 0;
+
+// The text once copied out, lines separated by '\n'
+static char *text = NULL;
+static size_t text_len = 0;
+
+// Writes the text of sel to out and returns its length, only measures it
+// if out is NULL
+static size_t clipboard_gather(const struct Selection *sel, char *out) {
+  size_t len = 0;
+
+  for (int y = sel->top; y <= sel->bottom; y++) {
+    if (y < E.num_rows) {
+      EditorRow *row = &E.row[y];
+      int from, to;
+
+      if (sel->mode == SELECT_BLOCK) {
+        from = editor_row_render_x_to_cursor_x(row, sel->left);
+        to = editor_row_render_x_to_cursor_x(row, sel->right);
+      } else {
+        from = y == sel->top ? sel->top_x : 0;
+        to = y == sel->bottom ? sel->bottom_x : row->size;
+      }
+
+      if (out) {
+        memcpy(&out[len], &row->chars[from], to - from);
+      }
+      len += to - from;
+    }
+
+    if (y < sel->bottom) {
+      if (out) {
+        out[len] = '\n';
+      }
+      len++;
+    }
+  }
+
+  return len;
+}
+
+static size_t clipboard_length(void) {
+  return referencing ? clipboard_gather(&region, NULL) : text_len;
+}
+
+static void clipboard_write(char *out) {
+  if (referencing) {
+    clipboard_gather(&region, out);
+  } else {
+    memcpy(out, text, text_len);
+  }
+}
+
+// Called before rows from at down are edited, inserted or deleted
+void clipboard_rows_changing(int at) {
+  if (!referencing || at > region.bottom) {
+    return;
+  }
+
+  text_len = clipboard_gather(&region, NULL);
+  text = mem_realloc(MEM_CLIPBOARD, text, text_len + 1);
+  clipboard_gather(&region, text);
+  referencing = 0;
+}
+
+// Takes the selection into the clipboard, returns its number of lines
+static int clipboard_take(const struct Selection *sel) {
+  region = *sel;
+  referencing = 1;
+  mem_free(text);
+  text = NULL;
+  text_len = 0;
+
+  selection_clear();
+  return sel->bottom - sel->top + 1;
+}
+
+void editor_copy(void) {
+  struct Selection sel;
+  if (!selection_get(&sel)) {
+    editor_set_status_message("Nothing selected");
+    return;
+  }
+
+  int lines = clipboard_take(&sel);
+  editor_set_status_message("Copied %d line%s", lines, lines == 1 ? "" : "s");
+}
+
+void editor_cut(void) {
+  struct Selection sel;
+  if (editor_read_only()) {
+    return;
+  }
+  if (!selection_get(&sel)) {
+    editor_set_status_message("Nothing selected");
+    return;
+  }
+
+  int lines = clipboard_take(&sel);
+  editor_set_status_message("Cut %d line%s", lines, lines == 1 ? "" : "s");
+  if (sel.top >= E.num_rows) {
+    return;
+  }
+
+  int last = sel.bottom < E.num_rows ? sel.bottom : E.num_rows - 1;
+
+  if (sel.mode == SELECT_BLOCK) {
+    struct RowEdit *edits = mem_malloc(
+        MEM_ROW_INDEX, sizeof(struct RowEdit) * (last - sel.top + 1));
+    int num_edits = 0;
+
+    for (int y = sel.top; y <= last; y++) {
+      EditorRow *row = &E.row[y];
+      int from = editor_row_render_x_to_cursor_x(row, sel.left);
+      int to = editor_row_render_x_to_cursor_x(row, sel.right);
+      if (from == to) {
+        continue;
+      }
+
+      char *buf = mem_malloc(MEM_ROW_TEXT, row->size - (to - from) + 1);
+      memcpy(buf, row->chars, from);
+      memcpy(&buf[from], &row->chars[to], row->size - to);
+      edits[num_edits++] = (struct RowEdit){
+          .row = y,
+          .text = buf,
+          .len = row->size - (to - from),
+      };
+    }
+
+    editor_rows_rewrite(edits, num_edits);
+    mem_free(edits);
+
+    E.cursor_y = sel.top;
+    E.cursor_x = editor_row_render_x_to_cursor_x(&E.row[sel.top], sel.left);
+    return;
+  }
+
+  // What is left of the first and last rows joins into one
+  EditorRow *top = &E.row[sel.top];
+  const char *rest = "";
+  int rest_len = 0;
+  if (sel.bottom < E.num_rows) {
+    rest = &E.row[sel.bottom].chars[sel.bottom_x];
+    rest_len = E.row[sel.bottom].size - sel.bottom_x;
+  }
+
+  char *buf = mem_malloc(MEM_ROW_TEXT, sel.top_x + rest_len + 1);
+  memcpy(buf, top->chars, sel.top_x);
+  memcpy(&buf[sel.top_x], rest, rest_len);
+  struct RowEdit edit = {
+      .row = sel.top,
+      .text = buf,
+      .len = sel.top_x + rest_len,
+  };
+
+  editor_del_rows(sel.top + 1, last - sel.top);
+  editor_rows_rewrite(&edit, 1);
+
+  E.cursor_y = sel.top;
+  E.cursor_x = sel.top_x;
+}
+
+// Pasted lines go in at the cursor, the text after it follows the last
+static void clipboard_paste_lines(void) {
+  EditorRow *row = &E.row[E.cursor_y];
+  size_t len = clipboard_length();
+  size_t at = E.cursor_x;
+
+  char *buf = mem_malloc(MEM_ROW_TEXT, row->size + len + 1);
+  memcpy(buf, row->chars, at);
+  clipboard_write(&buf[at]);
+  memcpy(&buf[at + len], &row->chars[at], row->size - at);
+
+  int lines = 0;
+  size_t last_start = 0;
+  const char *p = &buf[at];
+  const char *end = &buf[at + len];
+  while ((p = memchr(p, '\n', end - p)) != NULL) {
+    lines++;
+    p++;
+    last_start = p - &buf[at];
+  }
+
+  struct RowEdit edit = {
+      .row = E.cursor_y,
+      .text = buf,
+      .len = row->size + len,
+  };
+  editor_rows_rewrite(&edit, 1);
+
+  E.cursor_y += lines;
+  E.cursor_x = lines ? (int)(len - last_start) : (int)(at + len);
+}
+
+// Each line of a block goes into its own row at the cursor's column, rows
+// too short are padded with blanks and missing rows added
+static void clipboard_paste_block(void) {
+  size_t len = clipboard_length();
+  char *block = mem_malloc(MEM_CLIPBOARD, len + 1);
+  clipboard_write(block);
+
+  int rx = editor_row_cursor_x_to_render_x(&E.row[E.cursor_y], E.cursor_x);
+
+  int num_lines = 1;
+  for (const char *p = block; (p = memchr(p, '\n', block + len - p)); p++) {
+    num_lines++;
+  }
+
+  struct RowEdit *edits =
+      mem_malloc(MEM_ROW_INDEX, sizeof(struct RowEdit) * num_lines);
+  int num_edits = 0;
+
+  const char *line = block;
+  const char *end = block + len;
+  for (int y = E.cursor_y; line <= end; y++) {
+    const char *newline = memchr(line, '\n', end - line);
+    size_t line_len = (newline ? newline : end) - line;
+
+    // Lines past the last row go on as new rows split off the last edit
+    if (y >= E.num_rows) {
+      struct RowEdit *last = &edits[num_edits - 1];
+      size_t tail = end - line;
+      int lines_left = num_lines - (y - E.cursor_y);
+
+      last->text = mem_realloc(MEM_ROW_TEXT, last->text,
+                               last->len + tail + lines_left * (rx + 1) + 1);
+      char *to = &last->text[last->len];
+      while (line <= end) {
+        newline = memchr(line, '\n', end - line);
+        line_len = (newline ? newline : end) - line;
+
+        *to++ = '\n';
+        memset(to, ' ', rx);
+        to += rx;
+        memcpy(to, line, line_len);
+        to += line_len;
+
+        line += line_len + 1;
+      }
+      last->len = to - last->text;
+      break;
+    }
+
+    EditorRow *row = &E.row[y];
+    int at = editor_row_render_x_to_cursor_x(row, rx);
+    int pad = rx > row->r_size ? rx - row->r_size : 0;
+
+    char *buf = mem_malloc(MEM_ROW_TEXT, row->size + pad + line_len + 1);
+    memcpy(buf, row->chars, at);
+    memset(&buf[at], ' ', pad);
+    memcpy(&buf[at + pad], line, line_len);
+    memcpy(&buf[at + pad + line_len], &row->chars[at], row->size - at);
+    edits[num_edits++] = (struct RowEdit){
+        .row = y,
+        .text = buf,
+        .len = row->size + pad + line_len,
+    };
+
+    line += line_len + 1;
+  }
+
+  editor_rows_rewrite(edits, num_edits);
+  mem_free(edits);
+  mem_free(block);
+}
+
+void editor_paste(void) {
+  if (editor_read_only()) {
+    return;
+  }
+  if (region.mode == SELECT_NONE) {
+    editor_set_status_message("Nothing to paste");
+    return;
+  }
+
+  // A block goes on over the rows below the cursor
+  int bottom = E.cursor_y;
+  if (region.mode == SELECT_BLOCK) {
+    bottom += region.bottom - region.top;
+  }
+  if (bottom >= E.num_rows && editor_still_loading()) {
+    return;
+  }
+
+  selection_clear();
+  if (E.cursor_y == E.num_rows) {
+    editor_insert_row(E.num_rows, "", 0);
+  }
+
+  if (region.mode == SELECT_BLOCK) {
+    clipboard_paste_block();
+  } else {
+    clipboard_paste_lines();
+  }
+}
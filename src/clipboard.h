@@ -0,0 +1,12 @@
+#ifndef CLIPBOARD_H
+#define CLIPBOARD_H
+
+// Copied text, read from the rows it was copied from for as long as they
+// stay as they were
+
+void clipboard_rows_changing(int at);
+void editor_copy(void);
+void editor_cut(void);
+void editor_paste(void);
+
+#endif // CLIPBOARD_H
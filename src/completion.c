@@ -0,0 +1,399 @@
+#include <ctype.h>
+#include <string.h>
+
+#include "completion.h"
+#include "editor-io.h"
+#include "editor-operations.h"
+#include "editor.h"
+#include "file-io.h"
+#include "memory.h"
+#include "pool.h"
+#include "row-operations.h"
+
+extern struct EditorConfig E;
+
+// Shorter words aren't worth completing, longer ones aren't identifiers
+#define COMPLETION_MIN_WORD 3
+#define COMPLETION_MAX_WORD 64
+#define COMPLETION_CANDIDATES 8
+
+// Trie
+
+// Children of a node form a list sorted by byte. Nodes are never removed,
+// a word that no longer occurs just drops to a count of 0.
+struct TrieNode {
+  int child;
+  int sibling;
+  int count;
+  // Never below the largest count in the subtree, so lookups can skip
+  // subtrees that can't beat what they already have
+  int best;
+  unsigned char c;
+};
+
+struct WordIndex {
+  struct TrieNode *nodes;
+  int num_nodes;
+  int cap_nodes;
+};
+
+struct Completion {
+  char word[COMPLETION_MAX_WORD + 1];
+  int len;
+  int count;
+};
+
+static int word_index_new_node(struct WordIndex *index, unsigned char c) {
+  if (index->num_nodes == index->cap_nodes) {
+    index->cap_nodes = index->cap_nodes ? index->cap_nodes * 2 : 1024;
+    index->nodes = mem_realloc(MEM_WORD_INDEX, index->nodes,
+                               sizeof(struct TrieNode) * index->cap_nodes);
+  }
+
+  index->nodes[index->num_nodes] = (struct TrieNode){.c = c};
+  return index->num_nodes++;
+}
+
+static void word_index_init(struct WordIndex *index) {
+  *index = (struct WordIndex){0};
+  word_index_new_node(index, 0);
+}
+
+static void word_index_free(struct WordIndex *index) {
+  mem_free(index->nodes);
+  *index = (struct WordIndex){0};
+}
+
+// Child of node for byte c, created if create is set. Returns 0 if missing.
+static int word_index_child(struct WordIndex *index, int node, unsigned char c,
+                            int create) {
+  int prev = 0;
+  int next = index->nodes[node].child;
+
+  while (next && index->nodes[next].c < c) {
+    prev = next;
+    next = index->nodes[next].sibling;
+  }
+
+  if ((next && index->nodes[next].c == c) || !create) {
+    return next && index->nodes[next].c == c ? next : 0;
+  }
+
+  int child = word_index_new_node(index, c);
+  index->nodes[child].sibling = next;
+  if (prev) {
+    index->nodes[prev].sibling = child;
+  } else {
+    index->nodes[node].child = child;
+  }
+
+  return child;
+}
+
+static void word_index_add(struct WordIndex *index, const char *word, int len,
+                           int delta) {
+  int path[COMPLETION_MAX_WORD + 1];
+  int node = 0;
+
+  path[0] = 0;
+  for (int i = 0; i < len; i++) {
+    node = word_index_child(index, node, word[i], 1);
+    path[i + 1] = node;
+  }
+
+  int count = index->nodes[node].count += delta;
+  for (int i = 0; i <= len; i++) {
+    if (index->nodes[path[i]].best < count) {
+      index->nodes[path[i]].best = count;
+    }
+  }
+}
+
+// Stricter than is_separator, which lets quotes and braces into words
+static int is_word_char(char c) {
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+// Adds delta to every identifier in text
+static void word_index_add_text(struct WordIndex *index, const char *text,
+                                size_t len, int delta) {
+  size_t i = 0;
+
+  while (i < len) {
+    while (i < len && !is_word_char(text[i])) {
+      i++;
+    }
+
+    size_t start = i;
+    while (i < len && is_word_char(text[i])) {
+      i++;
+    }
+
+    size_t word_len = i - start;
+    if (word_len >= COMPLETION_MIN_WORD && word_len <= COMPLETION_MAX_WORD &&
+        !isdigit((unsigned char)text[start])) {
+      word_index_add(index, &text[start], word_len, delta);
+    }
+  }
+}
+
+// Adds every word of from into index
+static void word_index_merge(struct WordIndex *index, struct WordIndex *from,
+                             int node, char *word, int len) {
+  if (from->nodes[node].count != 0) {
+    word_index_add(index, word, len, from->nodes[node].count);
+  }
+
+  for (int child = from->nodes[node].child; child;
+       child = from->nodes[child].sibling) {
+    word[len] = from->nodes[child].c;
+    word_index_merge(index, from, child, word, len + 1);
+  }
+}
+
+// Keeps the max most frequent words longer than min_len below node in
+// found, most frequent first
+static void word_index_collect(struct WordIndex *index, int node, char *word,
+                               int len, int min_len, struct Completion *found,
+                               int *count, int max) {
+  struct TrieNode *n = &index->nodes[node];
+
+  if (n->count > 0 && len > min_len &&
+      (*count < max || n->count > found[*count - 1].count)) {
+    int at = *count < max ? (*count)++ : max - 1;
+    while (at > 0 && found[at - 1].count < n->count) {
+      found[at] = found[at - 1];
+      at--;
+    }
+
+    found[at] = (struct Completion){.len = len, .count = n->count};
+    memcpy(found[at].word, word, len);
+    found[at].word[len] = '\0';
+  }
+
+  for (int child = n->child; child; child = index->nodes[child].sibling) {
+    if (*count == max && index->nodes[child].best <= found[max - 1].count) {
+      continue;
+    }
+
+    word[len] = index->nodes[child].c;
+    word_index_collect(index, child, word, len + 1, min_len, found, count,
+                       max);
+  }
+}
+
+// The index
+
+// Edits made while a build runs on a worker go into delta and are merged
+// when the build lands, so its result is never stale.
+static struct WordIndex words;
+static struct WordIndex delta;
+static int building = 0;
+
+struct IndexBuild {
+  char *text;
+  size_t len;
+  struct WordIndex index;
+};
+
+static struct IndexBuild *current_build = NULL;
+static struct Task *current_task = NULL;
+
+static void completion_build(struct Task *task, void *arg) {
+  (void)task;
+  struct IndexBuild *build = arg;
+
+  word_index_init(&build->index);
+  word_index_add_text(&build->index, build->text, build->len, 1);
+
+  mem_free(build->text);
+  build->text = NULL;
+}
+
+static void completion_build_done(void *arg, int cancelled) {
+  struct IndexBuild *build = arg;
+
+  if (!cancelled && build == current_build) {
+    char word[COMPLETION_MAX_WORD + 1];
+    word_index_merge(&build->index, &delta, 0, word, 0);
+
+    word_index_free(&words);
+    word_index_free(&delta);
+    words = build->index;
+
+    building = 0;
+    current_build = NULL;
+    current_task = NULL;
+  } else {
+    word_index_free(&build->index);
+  }
+
+  mem_free(build->text);
+  mem_free(build);
+}
+
+static struct WordIndex *completion_target(void) {
+  if (building) {
+    return &delta;
+  }
+
+  if (words.nodes == NULL) {
+    word_index_init(&words);
+  }
+  return &words;
+}
+
+// Indexes all rows on a worker from a copy of the text
+void completion_index_rows(void) {
+  if (current_task) {
+    pool_cancel(current_task);
+  }
+
+  word_index_free(&delta);
+  word_index_init(&delta);
+  building = 1;
+
+  struct IndexBuild *build = mem_malloc(MEM_WORD_INDEX, sizeof(*build));
+  *build = (struct IndexBuild){0};
+  build->text = editor_rows_to_string(&build->len);
+
+  current_build = build;
+  current_task =
+      pool_submit(TASK_LOW, completion_build, completion_build_done, build);
+}
+
+int completion_ready(void) { return !building; }
+
+void completion_row_removed(EditorRow *row) {
+  if (row->r_chars) {
+    word_index_add_text(completion_target(), row->r_chars, row->r_size, -1);
+  }
+}
+
+// Moves the row's words from its old render text to its new one. Only the
+// words around the span where the two differ are taken out and put back.
+void completion_row_changed(EditorRow *row, const char *old, int old_size) {
+  const char *text = row->r_chars;
+  int size = row->r_size;
+
+  if (old == NULL) {
+    word_index_add_text(completion_target(), text, size, 1);
+    return;
+  }
+
+  int max = old_size < size ? old_size : size;
+  int prefix = 0;
+  while (prefix < max && old[prefix] == text[prefix]) {
+    prefix++;
+  }
+
+  int suffix = 0;
+  while (suffix < max - prefix &&
+         old[old_size - 1 - suffix] == text[size - 1 - suffix]) {
+    suffix++;
+  }
+
+  // Out to whole words, which are the same in both texts outside the span
+  while (prefix > 0 && is_word_char(text[prefix - 1])) {
+    prefix--;
+  }
+  while (suffix > 0 && is_word_char(text[size - suffix])) {
+    suffix--;
+  }
+
+  word_index_add_text(completion_target(), &old[prefix],
+                      old_size - suffix - prefix, -1);
+  word_index_add_text(completion_target(), &text[prefix],
+                      size - suffix - prefix, 1);
+}
+
+// Fills found with the most frequent words that start with prefix and are
+// longer than it
+static int completion_lookup(const char *prefix, int len,
+                             struct Completion *found, int max) {
+  if (words.nodes == NULL || len > COMPLETION_MAX_WORD) {
+    return 0;
+  }
+
+  int node = 0;
+  for (int i = 0; i < len; i++) {
+    node = word_index_child(&words, node, prefix[i], 0);
+    if (node == 0) {
+      return 0;
+    }
+  }
+
+  char word[COMPLETION_MAX_WORD + 1];
+  memcpy(word, prefix, len);
+
+  int count = 0;
+  word_index_collect(&words, node, word, len, len, found, &count, max);
+
+  return count;
+}
+
+// Completes the word left of the cursor with the most frequent match,
+// pressing it again right away moves on to the next one
+void editor_complete(void) {
+  static struct Completion candidates[COMPLETION_CANDIDATES];
+  static int num_candidates = 0;
+  static int current = 0;
+  static int prefix_len = 0;
+
+  static int last_x = -1;
+  static int last_y = -1;
+  static unsigned long last_version = 0;
+
+  if (E.cursor_y >= E.num_rows || editor_read_only()) {
+    return;
+  }
+  EditorRow *row = &E.row[E.cursor_y];
+
+  int again = num_candidates > 0 && E.version == last_version &&
+              E.cursor_x == last_x && E.cursor_y == last_y;
+
+  if (again) {
+    int inserted = candidates[current].len - prefix_len;
+    E.cursor_x -= inserted;
+    editor_row_del_chars(row, E.cursor_x, inserted);
+
+    current = (current + 1) % num_candidates;
+  } else {
+    int start = E.cursor_x;
+    while (start > 0 && is_word_char(row->chars[start - 1])) {
+      start--;
+    }
+
+    prefix_len = E.cursor_x - start;
+    if (prefix_len == 0) {
+      editor_set_status_message("Nothing to complete");
+      return;
+    }
+
+    if (building) {
+      editor_set_status_message("Still indexing words, try again shortly");
+      return;
+    }
+
+    current = 0;
+    num_candidates = completion_lookup(&row->chars[start], prefix_len,
+                                       candidates, COMPLETION_CANDIDATES);
+    if (num_candidates == 0) {
+      editor_set_status_message("No completions for %.*s", prefix_len,
+                                &row->chars[start]);
+      return;
+    }
+  }
+
+  struct Completion *pick = &candidates[current];
+  editor_row_insert_string(row, E.cursor_x, &pick->word[prefix_len],
+                           pick->len - prefix_len);
+  E.cursor_x += pick->len - prefix_len;
+
+  last_x = E.cursor_x;
+  last_y = E.cursor_y;
+  last_version = E.version;
+
+  editor_set_status_message("Complete: %s (%d/%d)", pick->word, current + 1,
+                            num_candidates);
+}
@@ -0,0 +1,15 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include "editor.h"
+
+// Identifiers of the buffer with how often they occur, for completing the
+// word left of the cursor
+
+void completion_index_rows(void);
+int completion_ready(void);
+void completion_row_removed(EditorRow *row);
+void completion_row_changed(EditorRow *row, const char *old, int old_size);
+void editor_complete(void);
+
+#endif // COMPLETION_H
@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cursors.h"
+#include "dirty.h"
+#include "editor-io.h"
+#include "editor-operations.h"
+#include "editor.h"
+#include "find.h"
+#include "memory.h"
+#include "row-operations.h"
+#include "selection.h"
+
+extern struct EditorConfig E;
+
+struct Cursor {
+  int y;
+  int x;
+};
+
+// Sorted by row then column, no two at the same place. The primary one is
+// E.cursor, which the screen follows, the others are drawn inverted. A
+// keystroke goes through them once in order, so each row they are on is
+// rewritten once and every position is worked out in the same pass.
+static struct Cursor *cursors = NULL;
+static int num_cursors = 0;
+static int cap_cursors = 0;
+static int primary = 0;
+
+static void cursors_push(int y, int x) {
+  if (num_cursors == cap_cursors) {
+    cap_cursors = cap_cursors ? cap_cursors * 2 : 64;
+    cursors = mem_realloc(MEM_ROW_INDEX, cursors,
+                          sizeof(struct Cursor) * cap_cursors);
+  }
+
+  cursors[num_cursors++] = (struct Cursor){.y = y, .x = x};
+}
+
+static int cursors_compare(const void *a, const void *b) {
+  const struct Cursor *p = a;
+  const struct Cursor *q = b;
+
+  if (p->y != q->y) {
+    return p->y < q->y ? -1 : 1;
+  }
+  return (p->x > q->x) - (p->x < q->x);
+}
+
+// Index of the first cursor at or after x on row y
+static int cursors_find(int y, int x) {
+  struct Cursor at = {.y = y, .x = x};
+  int lo = 0;
+  int hi = num_cursors;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (cursors_compare(&cursors[mid], &at) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+static void cursors_dirty(void) {
+  if (num_cursors > 0) {
+    dirty_add(&E.dirty_since_frame, cursors[0].y,
+              cursors[num_cursors - 1].y + 1);
+  }
+}
+
+// Number of cursors, 0 when there is only the usual one
+int cursors_active(void) { return num_cursors > 1 ? num_cursors : 0; }
+
+void cursors_clear(void) {
+  cursors_dirty();
+  num_cursors = 0;
+  primary = 0;
+}
+
+// Puts the cursors back in order after they moved, merges those that met
+// and has E.cursor follow the primary one
+static void cursors_settle(void) {
+  struct Cursor main = cursors[primary];
+
+  for (int i = 1; i < num_cursors; i++) {
+    if (cursors_compare(&cursors[i - 1], &cursors[i]) > 0) {
+      qsort(cursors, num_cursors, sizeof(struct Cursor), cursors_compare);
+      break;
+    }
+  }
+
+  int out = 0;
+  for (int i = 0; i < num_cursors; i++) {
+    if (out > 0 && cursors_compare(&cursors[out - 1], &cursors[i]) == 0) {
+      continue;
+    }
+    if (cursors_compare(&cursors[i], &main) == 0) {
+      primary = out;
+    }
+    cursors[out++] = cursors[i];
+  }
+  num_cursors = out;
+
+  E.cursor_y = main.y;
+  E.cursor_x = main.x;
+  cursors_dirty();
+
+  if (num_cursors == 1) {
+    num_cursors = 0;
+    primary = 0;
+  }
+}
+
+// Adds c, or breaks the row for '\r', at every cursor. A row gets all of its
+// cursors' characters in one rewrite, and the rows each break adds move the
+// cursors below down as the pass goes.
+static void cursors_insert(int c) {
+  if (cursors[num_cursors - 1].y == E.num_rows) {
+    if (editor_still_loading()) {
+      return;
+    }
+    editor_insert_row(E.num_rows, "", 0);
+  }
+
+  struct RowEdit *edits =
+      mem_malloc(MEM_ROW_INDEX, sizeof(struct RowEdit) * num_cursors);
+  int num_edits = 0;
+  int added = 0;
+
+  for (int i = 0; i < num_cursors;) {
+    int y = cursors[i].y;
+    int end = i;
+    while (end < num_cursors && cursors[end].y == y) {
+      end++;
+    }
+
+    EditorRow *row = &E.row[y];
+    char *buf = mem_malloc(MEM_ROW_TEXT, row->size + (end - i) + 1);
+    size_t len = 0;
+    int from = 0;
+
+    for (int n = 1; i < end; i++, n++) {
+      int at = cursors[i].x;
+      memcpy(&buf[len], &row->chars[from], at - from);
+      len += at - from;
+      buf[len++] = c == '\r' ? '\n' : c;
+      from = at;
+
+      if (c == '\r') {
+        cursors[i] = (struct Cursor){.y = y + added + n, .x = 0};
+      } else {
+        cursors[i] = (struct Cursor){.y = y + added, .x = at + n};
+      }
+    }
+
+    memcpy(&buf[len], &row->chars[from], row->size - from);
+    len += row->size - from;
+    edits[num_edits++] = (struct RowEdit){.row = y, .text = buf, .len = len};
+
+    if (c == '\r') {
+      added += len - row->size;
+    }
+  }
+
+  editor_rows_rewrite(edits, num_edits);
+  mem_free(edits);
+}
+
+// Deletes the character before every cursor, or the one under it going
+// forward. Only a single cursor joins rows, the others stop at the row's
+// edge, so the rows stay where they are.
+static void cursors_delete(int forward) {
+  struct RowEdit *edits =
+      mem_malloc(MEM_ROW_INDEX, sizeof(struct RowEdit) * num_cursors);
+  int num_edits = 0;
+
+  for (int i = 0; i < num_cursors;) {
+    int y = cursors[i].y;
+    if (y == E.num_rows) {
+      break;
+    }
+
+    EditorRow *row = &E.row[y];
+    char *buf = NULL;
+    size_t len = 0;
+    int from = 0;
+    int deleted = 0;
+
+    for (; i < num_cursors && cursors[i].y == y; i++) {
+      int at = cursors[i].x - !forward;
+      int gone = at >= 0 && at < row->size;
+
+      if (gone) {
+        if (buf == NULL) {
+          buf = mem_malloc(MEM_ROW_TEXT, row->size + 1);
+        }
+        memcpy(&buf[len], &row->chars[from], at - from);
+        len += at - from;
+        from = at + 1;
+      }
+
+      cursors[i].x -= deleted + (gone && !forward);
+      deleted += gone;
+    }
+
+    if (buf != NULL) {
+      memcpy(&buf[len], &row->chars[from], row->size - from);
+      len += row->size - from;
+      edits[num_edits++] =
+          (struct RowEdit){.row = y, .text = buf, .len = len};
+    }
+  }
+
+  editor_rows_rewrite(edits, num_edits);
+  mem_free(edits);
+}
+
+// Arrows keep each cursor on its row going left or right, and in its column
+// as far as the row allows going up or down
+static void cursors_move(int key) {
+  for (int i = 0; i < num_cursors; i++) {
+    struct Cursor *cursor = &cursors[i];
+    int size = cursor->y < E.num_rows ? E.row[cursor->y].size : 0;
+
+    switch (key) {
+    case ARROW_LEFT:
+      if (cursor->x > 0) {
+        cursor->x--;
+      }
+      break;
+
+    case ARROW_RIGHT:
+      if (cursor->x < size) {
+        cursor->x++;
+      }
+      break;
+
+    case ARROW_UP:
+      if (cursor->y > 0) {
+        cursor->y--;
+      }
+      break;
+
+    case ARROW_DOWN:
+      if (cursor->y < E.num_rows) {
+        cursor->y++;
+      }
+      break;
+
+    case HOME_KEY:
+      cursor->x = 0;
+      break;
+
+    case END_KEY:
+      cursor->x = size;
+      break;
+    }
+
+    size = cursor->y < E.num_rows ? E.row[cursor->y].size : 0;
+    if (cursor->x > size) {
+      cursor->x = size;
+    }
+  }
+}
+
+// Handles a key for all the cursors. Returns 0 for keys they don't take,
+// which leave the one usual cursor.
+int editor_cursors_key(int c) {
+  // Bytes of UTF-8 text come as negative chars
+  int typed = c == '\t' || c == '\r' || (c >= ' ' && c < BACKSPACE) || c < 0;
+
+  switch (c) {
+  case '\x1b':
+    cursors_clear();
+    return 1;
+
+  case ARROW_UP:
+  case ARROW_DOWN:
+  case ARROW_LEFT:
+  case ARROW_RIGHT:
+  case HOME_KEY:
+  case END_KEY:
+    cursors_dirty();
+    cursors_move(c);
+    break;
+
+  case BACKSPACE:
+  case CTRL_KEY('h'):
+  case DEL_KEY:
+    if (editor_read_only()) {
+      return 1;
+    }
+    cursors_dirty();
+    cursors_delete(c == DEL_KEY);
+    break;
+
+  default:
+    if (!typed) {
+      return 0;
+    }
+    if (editor_read_only()) {
+      return 1;
+    }
+    cursors_dirty();
+    cursors_insert(c);
+  }
+
+  cursors_settle();
+  return 1;
+}
+
+// Render column of the first cursor but the primary one in row at or right
+// of from_rx, INT_MAX if there is none
+int cursors_next(int row, int from_rx) {
+  if (num_cursors == 0 || row >= E.num_rows) {
+    return INT_MAX;
+  }
+
+  EditorRow *r = &E.row[row];
+  int i = cursors_find(row, editor_row_render_x_to_cursor_x(r, from_rx));
+
+  // The first may sit on a tab that starts left of from_rx
+  for (; i < num_cursors && cursors[i].y == row; i++) {
+    int rx = editor_row_cursor_x_to_render_x(r, cursors[i].x);
+    if (i != primary && rx >= from_rx) {
+      return rx;
+    }
+  }
+
+  return INT_MAX;
+}
+
+// One cursor on every selected row, at the block's left edge or in the
+// cursor's column, or else one at every match of the last search
+void editor_add_cursors(void) {
+  struct Selection sel;
+  const char *query = find_last_query();
+
+  cursors_clear();
+
+  if (selection_get(&sel)) {
+    int rx = sel.left;
+    if (sel.mode == SELECT_LINES) {
+      rx = E.cursor_y < E.num_rows
+               ? editor_row_cursor_x_to_render_x(&E.row[E.cursor_y],
+                                                 E.cursor_x)
+               : 0;
+    }
+
+    for (int y = sel.top; y <= sel.bottom && y < E.num_rows; y++) {
+      cursors_push(y, editor_row_render_x_to_cursor_x(&E.row[y], rx));
+    }
+    selection_clear();
+  } else if (query != NULL) {
+    size_t len = strlen(query);
+
+    for (int y = 0; y < E.num_rows; y++) {
+      EditorRow *row = &E.row[y];
+      const char *p = row->chars;
+      const char *end = row->chars + row->size;
+
+      while ((p = memmem(p, end - p, query, len)) != NULL) {
+        cursors_push(y, p - row->chars);
+        p += len;
+      }
+    }
+  } else {
+    editor_set_status_message("Select rows or search first");
+    return;
+  }
+
+  if (num_cursors == 0) {
+    editor_set_status_message("Nowhere to put cursors");
+    return;
+  }
+
+  // The one on the cursor's row or the first below it leads
+  primary = cursors_find(E.cursor_y, 0);
+  if (primary == num_cursors) {
+    primary = num_cursors - 1;
+  }
+
+  int count = num_cursors;
+  cursors_settle();
+  editor_set_status_message("%d cursor%s", count, count == 1 ? "" : "s");
+}
@@ -0,0 +1,13 @@
+#ifndef CURSORS_H
+#define CURSORS_H
+
+// Extra cursors, one on every row of the selection or at every match of the
+// last search. Typing, deleting and moving happen at all of them at once.
+
+int cursors_active(void);
+void cursors_clear(void);
+int cursors_next(int row, int from_rx);
+int editor_cursors_key(int c);
+void editor_add_cursors(void);
+
+#endif // CURSORS_H
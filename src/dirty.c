@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "dirty.h"
+#include "editor.h"
+#include "memory.h"
+
+// Index of the first range that ends at or after row
+static int dirty_find(const struct DirtyRanges *dirty, int row) {
+  int lo = 0;
+  int hi = dirty->count;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (dirty->ranges[mid].end < row) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+// Marks rows start to end (exclusive), merging with the ranges it touches
+void dirty_add(struct DirtyRanges *dirty, int start, int end) {
+  if (start >= end) {
+    return;
+  }
+
+  int first = dirty_find(dirty, start);
+  int last = first;
+  while (last < dirty->count && dirty->ranges[last].start <= end) {
+    if (dirty->ranges[last].start < start) {
+      start = dirty->ranges[last].start;
+    }
+    if (dirty->ranges[last].end > end) {
+      end = dirty->ranges[last].end;
+    }
+    last++;
+  }
+
+  // Ranges first to last collapse into one
+  int removed = last - first;
+  if (removed == 0) {
+    if (dirty->count == dirty->cap) {
+      dirty->cap = dirty->cap ? dirty->cap * 2 : 8;
+      dirty->ranges = mem_realloc(MEM_ROW_INDEX, dirty->ranges,
+                                  sizeof(struct RowRange) * dirty->cap);
+    }
+
+    memmove(&dirty->ranges[first + 1], &dirty->ranges[first],
+            sizeof(struct RowRange) * (dirty->count - first));
+    dirty->count++;
+  } else if (removed > 1) {
+    memmove(&dirty->ranges[first + 1], &dirty->ranges[last],
+            sizeof(struct RowRange) * (dirty->count - last));
+    dirty->count -= removed - 1;
+  }
+
+  dirty->ranges[first] = (struct RowRange){start, end};
+}
+
+// Moves the ranges along with delta rows inserted at at, or with -delta
+// rows deleted from at. Ranges inside deleted rows go away.
+void dirty_shift(struct DirtyRanges *dirty, int at, int delta) {
+  int out = 0;
+
+  for (int i = 0; i < dirty->count; i++) {
+    struct RowRange range = dirty->ranges[i];
+
+    if (delta > 0) {
+      range.start += range.start >= at ? delta : 0;
+      range.end += range.end > at ? delta : 0;
+    } else {
+      int gap_end = at - delta;
+      range.start = range.start < at        ? range.start
+                    : range.start < gap_end ? at
+                                            : range.start + delta;
+      range.end = range.end < at        ? range.end
+                  : range.end < gap_end ? at
+                                        : range.end + delta;
+    }
+
+    if (range.start == range.end) {
+      continue;
+    }
+
+    // Closing a gap can make two ranges touch
+    if (out > 0 && dirty->ranges[out - 1].end >= range.start) {
+      dirty->ranges[out - 1].end = range.end;
+      continue;
+    }
+
+    dirty->ranges[out++] = range;
+  }
+
+  dirty->count = out;
+}
+
+int dirty_contains(const struct DirtyRanges *dirty, int row) {
+  int i = dirty_find(dirty, row + 1);
+  return i < dirty->count && dirty->ranges[i].start <= row;
+}
+
+void dirty_clear(struct DirtyRanges *dirty) { dirty->count = 0; }
@@ -0,0 +1,11 @@
+#ifndef DIRTY_H
+#define DIRTY_H
+
+#include "editor.h"
+
+void dirty_add(struct DirtyRanges *dirty, int start, int end);
+void dirty_shift(struct DirtyRanges *dirty, int at, int delta);
+int dirty_contains(const struct DirtyRanges *dirty, int row);
+void dirty_clear(struct DirtyRanges *dirty);
+
+#endif // DIRTY_H
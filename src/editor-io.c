@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -8,16 +9,46 @@
 #include <unistd.h>
 
 #include "append_buffer.h"
+#include "brackets.h"
+#include "clipboard.h"
+#include "completion.h"
+#include "cursors.h"
+#include "dirty.h"
 #include "editor-io.h"
 #include "editor-operations.h"
 #include "editor.h"
 #include "file-io.h"
 #include "find.h"
+#include "highlight.h"
+#include "line-map.h"
+#include "loader.h"
+#include "memory.h"
+#include "perf.h"
+#include "pool.h"
+#include "replace.h"
 #include "row-operations.h"
+#include "selection.h"
+#include "session.h"
 #include "terminal.h"
 
 extern struct EditorConfig E;
 
+// Which of its wrapped lines the cursor is on
+static int editor_cursor_sub(void) {
+  if (!E.soft_wrap || E.cursor_y >= E.num_rows) {
+    return 0;
+  }
+
+  int sub = E.render_x / E.screen_cols;
+  int last = line_map_row_lines(E.cursor_y) - 1;
+  return sub < last ? sub : last;
+}
+
+// Render column the sub-th line of a row starts at
+static int editor_line_col(int sub) {
+  return E.soft_wrap ? sub * E.screen_cols : E.col_off;
+}
+
 // Sets and bound check the editor scroll off
 void editor_scroll(void) {
   E.render_x = 0;
@@ -26,16 +57,31 @@ void editor_scroll(void) {
         editor_row_cursor_x_to_render_x(&E.row[E.cursor_y], E.cursor_x);
   }
 
-  // Cursor Y
-  if (E.cursor_y < E.row_off) {
-    E.row_off = E.cursor_y;
+  // Cursor Y, in lines on screen since folded rows take none. Jumps may
+  // land inside a fold, which then opens.
+  line_map_reveal(E.cursor_y);
+
+  long cursor_line = line_map_visual(E.cursor_y) + editor_cursor_sub();
+  long top = line_map_visual(E.row_off) + E.wrap_off;
+
+  if (cursor_line < top) {
+    top = cursor_line;
   }
 
-  if (E.cursor_y >= E.row_off + E.screen_rows) {
-    E.row_off = E.cursor_y - E.screen_rows + 1;
+  if (cursor_line >= top + E.screen_rows) {
+    top = cursor_line - E.screen_rows + 1;
+  }
+
+  int sub;
+  E.row_off = line_map_locate(top, &sub);
+  E.wrap_off = sub;
+
+  // Cursor X, wrapped rows never scroll sideways
+  if (E.soft_wrap) {
+    E.col_off = 0;
+    return;
   }
 
-  // Cursor X
   if (E.render_x < E.col_off) {
     E.col_off = E.render_x;
   }
@@ -67,59 +113,186 @@ void editor_draw_welcome(struct abuf *ab) {
   ab_append(ab, welcome, welcome_len);
 }
 
-void editor_draw_rows(struct abuf *ab) {
-  for (size_t y = 0; y < E.screen_rows; y++) {
+// Draws line y of the text area showing file_row from render column col on,
+// the cursor must be at its start
+void editor_draw_row(struct abuf *ab, int y, int file_row, int col) {
+  if (file_row < E.num_rows) {
+    int len = E.row[file_row].r_size - col;
+    if (len < 0) {
+      len = 0;
+    }
+
+    if (len > E.screen_cols) {
+      len = E.screen_cols;
+    }
+
+    EditorRow *row = &E.row[file_row];
+    char *c = &row->r_chars[col];
+    uint8_t *hl = &row->hl[col];
+
+    // First control byte at or right of the screen, wrapped lines of long
+    // rows may start far into them
+    int ctrl = 0;
+    int ctrl_end = row->r_num_ctrl;
+    while (ctrl < ctrl_end) {
+      int mid = (ctrl + ctrl_end) / 2;
+      if (row->r_ctrl[mid] < col) {
+        ctrl = mid + 1;
+      } else {
+        ctrl_end = mid;
+      }
+    }
+
+    // Search matches are drawn over the highlight, the first one may have
+    // started on a line above
+    int match_end;
+    long match = (long)find_next_match(file_row, col, &match_end) - col;
+
+    // The selection is drawn inverted
+    int sel_start, sel_end;
+    long sel_from = LONG_MAX, sel_to = LONG_MAX;
+    if (selection_span(file_row, &sel_start, &sel_end)) {
+      sel_from = (long)sel_start - col;
+      sel_to = (long)sel_end - col;
+    }
+
+    // So are the cursors other than the one on the terminal
+    long cursor = (long)cursors_next(file_row, col) - col;
+
+    char *current_color = NULL;
 
-    int file_row = y + E.row_off;
-    if (file_row < E.num_rows) {
-      int len = E.row[file_row].r_size - E.col_off;
-      if (len < 0) {
-        len = 0;
+    int j = 0;
+    while (j < len) {
+      int next_ctrl = ctrl < row->r_num_ctrl ? row->r_ctrl[ctrl] - col
+                                             : len;
+      long next_bracket =
+          (long)brackets_next_highlight(file_row, j + col) - col;
+
+      if (j > cursor) {
+        cursor = (long)cursors_next(file_row, j + col) - col;
+      }
+      if (j >= (long)match_end - col) {
+        match = (long)find_next_match(file_row, j + col, &match_end) - col;
       }
+      int in_match = j >= match;
+      int selected = j >= sel_from && j < sel_to;
+
+      if ((j == next_bracket || j == cursor) && j != next_ctrl) {
+        ab_append(ab, INVERSE_FORMATTING, 4);
+        ab_append(ab, &c[j], 1);
+        ab_append(ab, RESET_FORMATTING, 3);
+        if (current_color != NULL) {
+          ab_append(ab, current_color, strlen(current_color));
+        }
 
-      if (len > E.screen_cols) {
-        len = E.screen_cols;
+        j++;
+        continue;
       }
 
-      char *c = &E.row[file_row].r_chars[E.col_off];
-      uint8_t *hl = &E.row[file_row].hl[E.col_off];
-
-      char *current_color = NULL;
-
-      for (int j = 0; j < len; j++) {
-        if (iscntrl(c[j])) {
-          char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-          ab_append(ab, INVERSE_FORMATTING, 4);
-          ab_append(ab, &sym, 1);
-          ab_append(ab, RESET_FORMATTING, 3);
-          if (current_color != NULL) {
-            ab_append(ab, current_color, strlen(current_color));
-          }
-        } else if (hl[j] == HL_NORMAL) {
-          if (current_color != NULL) {
-            ab_append(ab, TEXT_RESET, 5);
-            current_color = NULL;
-          }
-          ab_append(ab, &c[j], 1);
-        } else {
-          char *color = (char *)editor_syntax_to_color(hl[j]);
-          if (color != current_color) {
-            current_color = color;
-            ab_append(ab, color, strlen(color));
-          }
-          ab_append(ab, &c[j], 1);
+      if (j == next_ctrl) {
+        char sym = (c[j] <= 26) ? '@' + c[j] : '?';
+        ab_append(ab, INVERSE_FORMATTING, 4);
+        ab_append(ab, &sym, 1);
+        ab_append(ab, RESET_FORMATTING, 3);
+        if (current_color != NULL) {
+          ab_append(ab, current_color, strlen(current_color));
         }
+
+        ctrl++;
+        j++;
+        continue;
       }
 
-      ab_append(ab, TEXT_RESET, 5);
-    } else if (E.num_rows == 0 && y == E.screen_rows / 3) {
-      editor_draw_welcome(ab);
+      // Run of one highlight up to the next control byte or matched bracket
+      int end = j + 1;
+      int stop = next_ctrl < len ? next_ctrl : len;
+      if (next_bracket < stop) {
+        stop = next_bracket;
+      }
+      if (cursor < stop) {
+        stop = cursor;
+      }
+      long match_edge = in_match ? (long)match_end - col : match;
+      if (match_edge < stop) {
+        stop = match_edge;
+      }
+      long sel_edge = selected ? sel_to : sel_from;
+      if (sel_edge > j && sel_edge < stop) {
+        stop = sel_edge;
+      }
+      while (end < stop && (in_match || hl[end] == hl[j])) {
+        end++;
+      }
 
-    } else {
-      ab_append(ab, "~", 1);
+      uint8_t kind = in_match ? HL_MATCH : hl[j];
+      if (kind == HL_NORMAL) {
+        if (current_color != NULL) {
+          ab_append(ab, TEXT_RESET, 5);
+          current_color = NULL;
+        }
+      } else {
+        char *color = (char *)editor_syntax_to_color(kind);
+        if (color != current_color) {
+          current_color = color;
+          ab_append(ab, color, strlen(color));
+        }
+      }
+
+      if (selected) {
+        ab_append(ab, INVERSE_FORMATTING, 4);
+      }
+      ab_append(ab, &c[j], end - j);
+      if (selected) {
+        ab_append(ab, RESET_FORMATTING, 3);
+        if (current_color != NULL) {
+          ab_append(ab, current_color, strlen(current_color));
+        }
+      }
+      j = end;
+    }
+
+    // A cursor at the end of the row stands on a blank
+    int width = len;
+    if (col + len == row->r_size && len < E.screen_cols &&
+        cursors_next(file_row, row->r_size) == row->r_size) {
+      ab_append(ab, INVERSE_FORMATTING, 4);
+      ab_append(ab, " ", 1);
+      ab_append(ab, RESET_FORMATTING, 3);
+      width++;
+    }
+
+    // Headers of folds tell how much they hide if there's room
+    int folded = line_map_folded_at(file_row);
+    if (folded) {
+      char marker[32];
+      int marker_len =
+          snprintf(marker, sizeof(marker), " [+%d lines]", folded);
+
+      if (width + marker_len <= E.screen_cols) {
+        const char *color = editor_syntax_to_color(HL_COMMENT);
+        ab_append(ab, color, strlen(color));
+        ab_append(ab, marker, marker_len);
+      }
     }
 
-    ab_append(ab, CLEAR_LINE_RIGHT, 3);
+    ab_append(ab, TEXT_RESET, 5);
+  } else if (E.num_rows == 0 && y == E.screen_rows / 3) {
+    editor_draw_welcome(ab);
+
+  } else {
+    ab_append(ab, "~", 1);
+  }
+
+  ab_append(ab, CLEAR_LINE_RIGHT, 3);
+}
+
+void editor_draw_rows(struct abuf *ab) {
+  long top = line_map_visual(E.row_off) + E.wrap_off;
+
+  for (int y = 0; y < E.screen_rows; y++) {
+    int sub;
+    int file_row = line_map_locate(top + y, &sub);
+    editor_draw_row(ab, y, file_row, editor_line_col(sub));
     ab_append(ab, "\r\n", 2);
   }
 }
@@ -127,17 +300,41 @@ void editor_draw_rows(struct abuf *ab) {
 void editor_draw_status_bar(struct abuf *ab) {
   ab_append(ab, INVERSE_FORMATTING, 4);
 
-  char status[80], r_status[80];
-  int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
+  char status[160], r_status[80];
+  const char *view = E.binary ? "[binary]" : E.truncated ? "[truncated]" : "";
+  int len = snprintf(status, sizeof(status), "%.20s - %d lines %s%s",
                      E.filename ? E.filename : "[No Name]", E.num_rows,
-                     E.dirty ? "[+]" : "");
+                     E.dirty ? "[+]" : "", view);
+
+  if (loader_active()) {
+    len += snprintf(&status[len], sizeof(status) - len, "%s(loading %d%%)",
+                    E.dirty || E.binary ? " " : "", loader_progress());
+  }
+
+  if (E.perf_hud) {
+    len += snprintf(&status[len], sizeof(status) - len, " | ");
+    len += perf_hud_format(&status[len], sizeof(status) - len);
+  }
+
   if (len > E.screen_cols) {
     len = E.screen_cols;
   }
 
-  int r_len = snprintf(r_status, sizeof(r_status), "%s | %d/%d ",
-                       E.syntax ? E.syntax->filetype : "no ft", E.cursor_y + 1,
-                       E.num_rows);
+  int r_len = 0;
+  int cursors = cursors_active();
+  if (cursors) {
+    r_len = snprintf(r_status, sizeof(r_status), "%d cursors | ", cursors);
+  }
+
+  long matches = find_match_count();
+  if (matches >= 0) {
+    r_len += snprintf(&r_status[r_len], sizeof(r_status) - r_len,
+                      "%ld match%s | ", matches, matches == 1 ? "" : "es");
+  }
+
+  r_len += snprintf(&r_status[r_len], sizeof(r_status) - r_len,
+                    "%s%s | %d/%d ", E.syntax ? E.syntax->filetype : "no ft",
+                    E.crlf ? " | CRLF" : "", E.cursor_y + 1, E.num_rows);
 
   ab_append(ab, status, len);
 
@@ -151,7 +348,6 @@ void editor_draw_status_bar(struct abuf *ab) {
   }
 
   ab_append(ab, RESET_FORMATTING, 3);
-  ab_append(ab, "\r\n", 2);
 }
 
 void editor_draw_message_bar(struct abuf *ab) {
@@ -167,29 +363,154 @@ void editor_draw_message_bar(struct abuf *ab) {
   }
 }
 
+// What the terminal shows: one hash per screen line, the text area first,
+// then the status and message bars. 0 marks a line that must be redrawn.
+static uint64_t *screen_hashes = NULL;
+static int screen_lines = 0;
+static long screen_top = 0;
+static int screen_col_off = 0;
+
+static uint64_t screen_line_hash(const char *s, int len) {
+  uint64_t hash = 14695981039346656037ull;
+
+  for (int i = 0; i < len; i++) {
+    hash ^= (uint8_t)s[i];
+    hash *= 1099511628211ull;
+  }
+
+  return hash;
+}
+
+// Makes the next frame redraw every line
+void editor_invalidate_screen(void) { screen_lines = 0; }
+
+// Every line must be drawn again, the bars are still compared
+static void editor_forget_text_area(void) {
+  memset(screen_hashes, 0, sizeof(uint64_t) * E.screen_rows);
+}
+
+// Moves the lines still on screen with the terminal's own scrolling, so
+// only the rows it exposes have to be drawn. Returns 0 if the lines on
+// screen no longer show the rows they did.
+static int editor_scroll_screen(struct abuf *ab, long top) {
+  long delta = top - screen_top;
+  long distance = delta < 0 ? -delta : delta;
+
+  if (E.col_off != screen_col_off || distance >= E.screen_rows) {
+    return 0;
+  }
+  if (delta == 0) {
+    return 1;
+  }
+
+  // Scroll region, scroll up or down, then reset the region
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "\x1b[1;%dr\x1b[%ld%c\x1b[r",
+                     E.screen_rows, distance, delta > 0 ? 'S' : 'T');
+  ab_append(ab, buf, len);
+
+  int kept = E.screen_rows - distance;
+  if (delta > 0) {
+    memmove(&screen_hashes[0], &screen_hashes[distance],
+            sizeof(uint64_t) * kept);
+    memset(&screen_hashes[kept], 0, sizeof(uint64_t) * distance);
+  } else {
+    memmove(&screen_hashes[distance], &screen_hashes[0],
+            sizeof(uint64_t) * kept);
+    memset(&screen_hashes[0], 0, sizeof(uint64_t) * distance);
+  }
+
+  return 1;
+}
+
 void editor_refresh_screen(void) {
+  uint64_t trace_start = perf_trace_begin();
+  perf_frame_begin();
+
   editor_scroll();
+  highlight_visible();
+  brackets_update_match();
+  selection_track();
 
-  struct abuf ab = ABUF_INIT;
+  long top = line_map_visual(E.row_off) + E.wrap_off;
+  int count = E.screen_rows + 2;
 
+  struct abuf ab = ABUF_INIT;
   ab_append(&ab, CURSOR_HIDE, 6);
-  ab_append(&ab, CURSOR_HOME_CMD, 3);
 
-  editor_draw_rows(&ab);
-  editor_draw_status_bar(&ab);
-  editor_draw_message_bar(&ab);
+  if (screen_lines != count) {
+    screen_hashes =
+        mem_realloc(MEM_FRAME, screen_hashes, sizeof(uint64_t) * count);
+    memset(screen_hashes, 0, sizeof(uint64_t) * count);
+    screen_lines = count;
+  } else if (!editor_scroll_screen(&ab, top)) {
+    editor_forget_text_area();
+  }
+
+  // Lines that may differ from the terminal are drawn into lines, the ones
+  // whose hash changed are sent. A row that wasn't touched since the last
+  // frame still shows what it did then.
+  struct abuf lines = ABUF_INIT;
+  int *offsets = mem_malloc(MEM_FRAME, sizeof(int) * (count + 1));
+
+  for (int y = 0; y < count; y++) {
+    offsets[y] = lines.len;
+
+    if (y < E.screen_rows) {
+      int sub;
+      int file_row = line_map_locate(top + y, &sub);
+      if (screen_hashes[y] == 0 ||
+          dirty_contains(&E.dirty_since_frame, file_row)) {
+        editor_draw_row(&lines, y, file_row, editor_line_col(sub));
+      }
+    } else if (y == E.screen_rows) {
+      editor_draw_status_bar(&lines);
+    } else {
+      editor_draw_message_bar(&lines);
+    }
+  }
+  offsets[count] = lines.len;
+
+  for (int y = 0; y < count; y++) {
+    const char *line = &lines.buffer[offsets[y]];
+    int len = offsets[y + 1] - offsets[y];
+    if (len == 0) {
+      continue;
+    }
+
+    uint64_t hash = screen_line_hash(line, len);
+    if (hash == screen_hashes[y]) {
+      continue;
+    }
+    screen_hashes[y] = hash;
+
+    char buf[32];
+    int buf_len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+    ab_append(&ab, buf, buf_len);
+    ab_append(&ab, line, len);
+  }
+
+  screen_top = top;
+  screen_col_off = E.col_off;
+  dirty_clear(&E.dirty_since_frame);
 
   char buf[32];
+  int cursor_sub = editor_cursor_sub();
   // Format cursor position escape sequence into buf
   snprintf(buf, sizeof(buf), "\x1b[%d;%dH",
-           (E.cursor_y - E.row_off) + 1, //
-           (E.render_x - E.col_off) + 1);
+           (int)(line_map_visual(E.cursor_y) + cursor_sub - top) + 1, //
+           (E.render_x - editor_line_col(cursor_sub)) + 1);
   ab_append(&ab, buf, strlen(buf));
 
   ab_append(&ab, CURSOR_SHOW, 6);
 
+  perf_frame_end(ab.len);
   write(STDOUT_FILENO, ab.buffer, ab.len);
   ab_free(&ab);
+  ab_free(&lines);
+  mem_free(offsets);
+
+  perf_trace_end("editor_refresh_screen", trace_start);
 }
 
 void editor_set_status_message(const char *fmt, ...) {
@@ -202,6 +523,31 @@ void editor_set_status_message(const char *fmt, ...) {
   E.status_msg_time = time(NULL);
 }
 
+// Called while waiting for a key, applies finished background work and
+// highlights in slices until a key arrives
+void editor_idle(void) {
+  if (terminal_resized()) {
+    editor_invalidate_screen();
+    editor_refresh_screen();
+  }
+
+  if (pool_drain()) {
+    editor_refresh_screen();
+  }
+
+  while (highlight_pending() && !terminal_input_pending()) {
+    if (highlight_run(HIGHLIGHT_SLICE_NS)) {
+      editor_refresh_screen();
+    }
+  }
+
+  while (find_count_pending() && !terminal_input_pending()) {
+    if (find_count_run(FIND_SLICE_NS)) {
+      editor_refresh_screen();
+    }
+  }
+}
+
 // input
 
 char *editor_prompt(char *prompt, void (*callback)(char *, int)) {
@@ -220,7 +566,6 @@ char *editor_prompt(char *prompt, void (*callback)(char *, int)) {
       if (buf_len != 0) {
         buf[--buf_len] = '\0';
       }
-      continue;
     }
 
     if (c == ESC_KEY) {
@@ -259,17 +604,54 @@ char *editor_prompt(char *prompt, void (*callback)(char *, int)) {
   }
 }
 
+// Keeps the cursor from going past the end of its row
+static void editor_clamp_cursor_x(void) {
+  EditorRow *row = (E.cursor_y >= E.num_rows) ? NULL : &E.row[E.cursor_y];
+  int row_len = row ? row->size : 0;
+  if (E.cursor_x > row_len) {
+    E.cursor_x = row_len;
+  }
+}
+
+// Screen line the cursor is on, counted from the first row
+static long editor_cursor_line(void) {
+  E.render_x = 0;
+  if (E.cursor_y < E.num_rows) {
+    E.render_x =
+        editor_row_cursor_x_to_render_x(&E.row[E.cursor_y], E.cursor_x);
+  }
+
+  return line_map_visual(E.cursor_y) + editor_cursor_sub();
+}
+
+// Moves the cursor to a screen line. With soft wrap it keeps to the screen
+// column it is in, otherwise to its place in the row.
+static void editor_move_to_line(long line) {
+  int col = E.soft_wrap ? E.render_x % E.screen_cols : 0;
+
+  int sub;
+  E.cursor_y = line_map_locate(line, &sub);
+
+  if (E.soft_wrap && E.cursor_y < E.num_rows) {
+    E.cursor_x = editor_row_render_x_to_cursor_x(
+        &E.row[E.cursor_y], sub * E.screen_cols + col);
+  }
+
+  editor_clamp_cursor_x();
+}
+
 void editor_move_cursor(int key) {
   EditorRow *row = (E.cursor_y >= E.num_rows) ? NULL : &E.row[E.cursor_y];
+  long line = editor_cursor_line();
 
   switch (key) {
   // Up
   case ARROW_UP:
-    if (E.cursor_y == 0) {
+    if (line == 0) {
       return;
     }
 
-    E.cursor_y--;
+    editor_move_to_line(line - 1);
     break;
 
   // Down
@@ -278,15 +660,15 @@ void editor_move_cursor(int key) {
       return;
     }
 
-    E.cursor_y++;
+    editor_move_to_line(line + 1);
     break;
 
   // Left
   case ARROW_LEFT:
     if (E.cursor_x == 0) {
       // Move cursor up to the end of the previous row if not at the top row
-      if (E.cursor_y > 0) {
-        E.cursor_y--;
+      if (line_map_prev_row(E.cursor_y) >= 0) {
+        E.cursor_y = line_map_prev_row(E.cursor_y);
         E.cursor_x = E.row[E.cursor_y].size;
       }
 
@@ -302,7 +684,7 @@ void editor_move_cursor(int key) {
       // Move cursor to the beginning of the next row if at the end of the
       // current row
       if (row && E.cursor_x == row->size) {
-        E.cursor_y++;
+        E.cursor_y = line_map_next_row(E.cursor_y);
         E.cursor_x = 0;
       }
       return;
@@ -312,11 +694,7 @@ void editor_move_cursor(int key) {
     break;
   }
 
-  row = (E.cursor_y >= E.num_rows) ? NULL : &E.row[E.cursor_y];
-  int row_len = row ? row->size : 0;
-  if (E.cursor_x > row_len) {
-    E.cursor_x = row_len;
-  }
+  editor_clamp_cursor_x();
 }
 
 void editor_process_keypress(void) {
@@ -324,6 +702,15 @@ void editor_process_keypress(void) {
 
   int c = editor_read_key();
 
+  // Extra cursors take the keys that type or move, any other leaves the one
+  if (cursors_active()) {
+    if (editor_cursors_key(c)) {
+      quit_times = KILO_QUIT_TIMES;
+      return;
+    }
+    cursors_clear();
+  }
+
   switch (c) {
 
   case '\r':
@@ -341,7 +728,11 @@ void editor_process_keypress(void) {
     break;
 
   case CTRL_KEY('l'):
+    editor_invalidate_screen();
+    break;
+
   case '\x1b':
+    selection_clear();
     break;
 
   // Quit
@@ -354,6 +745,8 @@ void editor_process_keypress(void) {
       return;
     }
 
+    session_save();
+
     write(STDOUT_FILENO, CLEAR_SCREEN_CMD, 4);
     write(STDOUT_FILENO, CURSOR_HOME_CMD, 3);
     exit(EXIT_SUCCESS);
@@ -369,24 +762,80 @@ void editor_process_keypress(void) {
     editor_find();
     break;
 
-  case PAGE_UP:
-  case PAGE_DOWN: {
-    if (c == PAGE_UP) {
-      E.cursor_y = E.row_off;
-    } else if (c == PAGE_DOWN) {
-      E.cursor_y = E.row_off + E.screen_rows - 1;
-      if (E.cursor_y > E.num_rows) {
-        E.cursor_y = E.num_rows;
-      }
-    }
+  // Replace all
+  case CTRL_KEY('r'):
+    editor_replace();
+    break;
 
-    uint16_t times = E.screen_rows;
-    while (times--) {
-      editor_move_cursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-    }
+  // Select lines, then a block, then nothing
+  case CTRL_KEY('e'):
+    editor_toggle_selection();
+    break;
+
+  case CTRL_KEY('c'):
+    editor_copy();
+    break;
+
+  case CTRL_KEY('x'):
+    editor_cut();
+    break;
+
+  case CTRL_KEY('v'):
+    editor_paste();
+    break;
+
+  // A cursor on every selected row or search match
+  case CTRL_KEY('a'):
+    editor_add_cursors();
+    break;
+
+  // Matching bracket
+  case CTRL_KEY('b'):
+    editor_jump_to_bracket();
+    break;
+
+  // Soft wrap, every line moves
+  case CTRL_KEY('w'):
+    E.soft_wrap = !E.soft_wrap;
+    E.col_off = 0;
+    E.wrap_off = 0;
+    editor_invalidate_screen();
+    break;
+
+  // Fold or unfold the block under the cursor row
+  case CTRL_KEY('k'):
+    editor_toggle_fold();
+    break;
+
+  // Word completion
+  case CTRL_KEY('n'):
+    editor_complete();
+    break;
+
+  // Performance HUD
+  case CTRL_KEY('t'):
+    E.perf_hud = !E.perf_hud;
+    break;
+
+  // Memory usage
+  case CTRL_KEY('g'): {
+    char usage[sizeof(E.status_msg)];
+    mem_format_usage(usage, sizeof(usage));
+    editor_set_status_message("%s", usage);
     break;
   }
 
+  // Moves the cursor to the edge of the screen, then a whole screen on
+  case PAGE_UP:
+    editor_move_to_line(line_map_visual(E.row_off) + E.wrap_off -
+                        E.screen_rows);
+    break;
+
+  case PAGE_DOWN:
+    editor_move_to_line(line_map_visual(E.row_off) + E.wrap_off +
+                        2 * E.screen_rows - 1);
+    break;
+
   case HOME_KEY:
     E.cursor_x = 0;
     break;
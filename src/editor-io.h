@@ -7,9 +7,11 @@
 
 void editor_scroll(void);
 void editor_draw_welcome(struct abuf *ab);
+void editor_draw_row(struct abuf *ab, int y, int file_row, int col);
 void editor_draw_rows(struct abuf *ab);
 void editor_draw_status_bar(struct abuf *ab);
 void editor_draw_message_bar(struct abuf *ab);
+void editor_invalidate_screen(void);
 void editor_refresh_screen(void);
 void editor_set_status_message(const char *fmt, ...);
 
@@ -17,6 +19,7 @@ void editor_set_status_message(const char *fmt, ...);
 
 void editor_set_status_message(const char *fmt, ...);
 void editor_refresh_screen(void);
+void editor_idle(void);
 char *editor_prompt(char *prompt, void (*callback)(char *, int));
 void editor_process_keypress(void);
 
@@ -1,10 +1,45 @@
+#include "editor-io.h"
+#include "editor-operations.h"
 #include "editor.h"
+#include "loader.h"
 #include "row-operations.h"
 
 extern struct EditorConfig E;
 
+// Code that takes row text for C strings would stop at a NUL, so binary
+// files are only viewed, and so are compressed files with the end missing.
+// Says so and returns 1 for those.
+int editor_read_only(void) {
+  if (E.binary) {
+    editor_set_status_message("Binary file, opened view only");
+  } else if (E.truncated) {
+    editor_set_status_message("Compressed file is cut short, opened view only");
+  }
+
+  return E.binary || E.truncated;
+}
+
+// While the file loads, the rows past the last one are still being read
+// and go after it. A row added there would end up above them, so rows may
+// only be added below the last one once the file is read. Says so and
+// returns 1 until then.
+int editor_still_loading(void) {
+  if (loader_active()) {
+    editor_set_status_message("Can't add rows while the file is still loading");
+  }
+
+  return loader_active();
+}
+
 void editor_insert_char(int c) {
+  if (editor_read_only()) {
+    return;
+  }
+
   if (E.cursor_y == E.num_rows) {
+    if (editor_still_loading()) {
+      return;
+    }
     editor_insert_row(E.num_rows, "", 0);
   }
   editor_row_insert_char(&E.row[E.cursor_y], E.cursor_x, c);
@@ -13,6 +48,14 @@ void editor_insert_char(int c) {
 }
 
 void editor_insert_new_line(void) {
+  if (editor_read_only()) {
+    return;
+  }
+
+  if (E.cursor_y == E.num_rows && editor_still_loading()) {
+    return;
+  }
+
   if (E.cursor_x == 0) {
     editor_insert_row(E.cursor_y, "", 0);
     E.cursor_y++;
@@ -25,16 +68,17 @@ void editor_insert_new_line(void) {
   editor_insert_row(E.cursor_y + 1, &row->chars[E.cursor_x],
                     row->size - E.cursor_x);
 
-  row = &E.row[E.cursor_y];
-  row->size = E.cursor_x;
-  row->chars[row->size] = '\0';
-  editor_update_row(row);
+  editor_row_truncate(&E.row[E.cursor_y], E.cursor_x);
 
   E.cursor_y++;
   E.cursor_x = 0;
 }
 
 void editor_del_char(void) {
+  if (editor_read_only()) {
+    return;
+  }
+
   if (E.cursor_y == E.num_rows) {
     return;
   }
@@ -1,6 +1,8 @@
 #ifndef EDITOR_OPERATIONS_H
 #define EDITOR_OPERATIONS_H
 
+int editor_read_only(void);
+int editor_still_loading(void);
 void editor_insert_char(int c);
 void editor_insert_new_line(void);
 void editor_del_char(void);
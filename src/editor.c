@@ -1,7 +1,6 @@
 #include "editor.h"
 
 const char *KILO_VERSION = "0.0.1";
-const size_t KILO_TAB_STOP = 4;
 
 const int ESC_KEY = '\x1b';
 
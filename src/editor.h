@@ -12,10 +12,15 @@
 #define KILO_QUIT_TIMES 3
 #define CTRL_KEY(k) ((k) & 0x1f)
 
+// A constant, so the column math in the render loops folds into masks.
+// Build with -DKILO_TAB_STOP=8 for another width.
+#ifndef KILO_TAB_STOP
+#define KILO_TAB_STOP 4
+#endif
+
 // Constants
 
 extern const char *KILO_VERSION;
-extern const size_t KILO_TAB_STOP;
 
 extern const int ESC_KEY;
 
@@ -67,10 +72,37 @@ typedef struct {
   char *chars;
   char *r_chars;
 
+  // Render positions of control bytes, drawn as inverse glyphs
+  int *r_ctrl;
+  int r_num_ctrl;
+
   uint8_t *hl;
   int hl_open_comment;
+
+  // Brackets outside strings and comments, see brackets.c
+  struct Bracket *brackets;
+  int num_brackets;
+
+  // E.version of the last edit to this row, 0 if unchanged since loading
+  unsigned long version;
+  // Where the row starts in the file on disk, only kept up to date for rows
+  // outside E.dirty_since_save
+  off_t disk_offset;
 } EditorRow;
 
+// Rows start to end, end excluded
+struct RowRange {
+  int start;
+  int end;
+};
+
+// Sorted ranges of rows that neither overlap nor touch
+struct DirtyRanges {
+  struct RowRange *ranges;
+  int count;
+  int cap;
+};
+
 struct EditorConfig {
   // Position
   int cursor_x;
@@ -78,6 +110,10 @@ struct EditorConfig {
   int render_x;
   int row_off;
   int col_off;
+  // Wrapped lines of row_off above the screen
+  int wrap_off;
+  // Long rows continue on the lines below instead of scrolling sideways
+  int soft_wrap;
 
   uint16_t screen_rows;
   uint16_t screen_cols;
@@ -88,6 +124,30 @@ struct EditorConfig {
   // File
   char *filename;
   int dirty;
+  // Bumped on every edit, never reset
+  unsigned long version;
+  // Rows edited since the last save, moved along when rows are inserted or
+  // deleted above them. May reach one past the last row after deletes.
+  struct DirtyRanges dirty_since_save;
+  // Row indexes whose text or highlight changed since the last frame
+  struct DirtyRanges dirty_since_frame;
+  // The file as last loaded or saved. If disk_known is set it holds exactly
+  // the rows, each followed by its line ending, so saves can write in place.
+  int disk_known;
+  // Set if the file is gzip-compressed, saves then compress it again
+  int disk_gzip;
+  off_t disk_size;
+  time_t disk_mtime;
+  long disk_mtime_nsec;
+  // Lines end in "\r\n" if crlf is set, the last one too unless
+  // final_newline is clear. Saves keep both.
+  int crlf;
+  int final_newline;
+  // Set if the file looked binary when opened, it can then only be viewed
+  int binary;
+  // Set if a compressed file broke off while loading. Saving would write
+  // back only the rows before the break, so it too can only be viewed.
+  int truncated;
 
   // Status Bar
   char status_msg[80];
@@ -96,6 +156,9 @@ struct EditorConfig {
   // Metadata
   struct EditorSyntax *syntax;
   struct termios orig_termios;
+
+  // Diagnostics
+  int perf_hud;
 };
 
 #endif
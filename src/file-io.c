@@ -4,44 +4,169 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "completion.h"
+#include "dirty.h"
 #include "editor-io.h"
+#include "editor-operations.h"
 #include "editor.h"
 #include "file-io.h"
+#include "gzip.h"
+#include "highlight.h"
+#include "journal.h"
+#include "loader.h"
+#include "memory.h"
+#include "perf.h"
 #include "row-operations.h"
+#include "session.h"
 #include "terminal.h"
 
 extern struct EditorConfig E;
 
-char *editor_rows_to_string(int *buf_len) {
-  int total_len = 0;
+// Bytes that end row at in the file: the file's line ending, or none after
+// the last row of a file that didn't end in one
+int editor_newline_len(int at) {
+  if (at == E.num_rows - 1 && !E.final_newline) {
+    return 0;
+  }
+
+  return E.crlf ? 2 : 1;
+}
+
+const char *editor_newline(void) { return E.crlf ? "\r\n" : "\n"; }
+
+char *editor_rows_to_string(size_t *buf_len) {
+  size_t total_len = 0;
 
   for (int i = 0; i < E.num_rows; i++) {
-    total_len += E.row[i].size + 1;
+    total_len += E.row[i].size + editor_newline_len(i);
   }
   *buf_len = total_len;
 
-  char *buf = malloc(total_len);
+  char *buf = mem_malloc(MEM_FILE_IO, total_len ? total_len : 1);
   char *p = buf;
   for (int i = 0; i < E.num_rows; i++) {
     memcpy(p, E.row[i].chars, E.row[i].size);
-
     p += E.row[i].size;
-    *p = '\n';
-    p++;
+
+    memcpy(p, editor_newline(), editor_newline_len(i));
+    p += editor_newline_len(i);
   }
 
   return buf;
 }
 
+static int write_all(int fd, const void *data, size_t len) {
+  const char *p = data;
+
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+#define SAVE_BUF (1 << 16)
+
+// Writes the rows and their line endings from the start of fd, a buffer at
+// a time, so the text is never whole in memory
+static int editor_write_rows(int fd, off_t *written) {
+  char *buf = mem_malloc(MEM_FILE_IO, SAVE_BUF);
+  size_t len = 0;
+  int result = lseek(fd, 0, SEEK_SET) == -1 ? -1 : 0;
+
+  *written = 0;
+  for (int i = 0; i < E.num_rows && result == 0; i++) {
+    const char *parts[2] = {E.row[i].chars, editor_newline()};
+    size_t lens[2] = {E.row[i].size, editor_newline_len(i)};
+
+    for (int j = 0; j < 2 && result == 0; j++) {
+      // A row longer than the buffer goes out straight from the row
+      if (len + lens[j] > SAVE_BUF) {
+        result = write_all(fd, buf, len);
+        len = 0;
+      }
+      if (result == 0 && lens[j] > SAVE_BUF) {
+        result = write_all(fd, parts[j], lens[j]);
+      } else if (result == 0) {
+        memcpy(&buf[len], parts[j], lens[j]);
+        len += lens[j];
+      }
+      *written += lens[j];
+    }
+  }
+
+  if (result == 0) {
+    result = write_all(fd, buf, len);
+  }
+
+  mem_free(buf);
+  return result;
+}
+
+static uint64_t open_trace_start;
+static int open_lexes;
+
+// Rows of the file being opened reach E in batches. A file reopened
+// unchanged only lexes the rows it shows, any other was lexed by the
+// loader piece by piece, and only a piece that really starts inside a
+// comment has to be lexed again.
+static void editor_rows_loaded(int first, int count, int finished) {
+  if (count > 0 && !session_rows_loaded(first, count)) {
+    if (!open_lexes) {
+      editor_highlight_from(first);
+    } else if (first > 0 && E.row[first - 1].hl_open_comment) {
+      highlight_schedule(first);
+    }
+  }
+
+  // The first rows also replace the welcome screen
+  dirty_add(&E.dirty_since_frame, first, INT_MAX);
+
+  if (!finished) {
+    return;
+  }
+
+  if (!session_end()) {
+    editor_highlight_from(0);
+  }
+  completion_index_rows();
+
+  perf_trace_end("editor_open", open_trace_start);
+}
+
 void editor_open(char *filename) {
-  FILE *file_pointer = fopen(filename, "r");
-  if (!file_pointer) {
-    die("fopen");
+  open_trace_start = perf_trace_begin();
+
+  int recovered = journal_recover(filename);
+  if (recovered == 1) {
+    editor_set_status_message("Finished a save that was interrupted");
+  } else if (recovered == 2) {
+    editor_set_status_message("Dropped an interrupted save, the file has "
+                              "changed since");
+  } else if (recovered == -1) {
+    editor_set_status_message("Can't finish the interrupted save of %s: %s",
+                              filename, strerror(errno));
+  }
+
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    die("open");
   }
 
   free(E.filename);
@@ -49,31 +174,144 @@ void editor_open(char *filename) {
 
   editor_select_syntax_highlight();
 
-  char *line = NULL;
-  size_t line_cap = 0;
+  E.dirty = 0;
+  dirty_clear(&E.dirty_since_save);
+
+  open_lexes = !session_begin(fd);
+  if (editor_load_rows(fd, open_lexes, editor_rows_loaded) == -1) {
+    die("read");
+  }
+  close(fd);
+}
+
+// Remembers the file as just written, fd must hold exactly the rows
+static void editor_mark_saved(int fd) {
+  E.dirty = 0;
+  dirty_clear(&E.dirty_since_save);
 
-  ssize_t line_len;
-  while ((line_len = getline(&line, &line_cap, file_pointer)) != -1) {
+  // Without its size and time the file can't be trusted to hold the rows
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    E.disk_known = 0;
+    return;
+  }
 
-    while (line_len > 0) {
-      char last_char = line[line_len - 1];
-      if (last_char != '\n' && last_char != '\r') {
-        break;
-      }
+  E.disk_known = !E.disk_gzip && E.final_newline;
+  E.disk_size = st.st_size;
+  E.disk_mtime = st.st_mtim.tv_sec;
+  E.disk_mtime_nsec = st.st_mtim.tv_nsec;
+}
 
-      line_len--;
+// Gives the rows start to end their offsets from offset on and copies them
+// into a journal record
+static off_t editor_save_record(struct JournalRecord *record, int start,
+                                int end, off_t offset) {
+  size_t len = 0;
+  for (int i = start; i < end; i++) {
+    len += E.row[i].size + editor_newline_len(i);
+  }
+
+  char *data = mem_malloc(MEM_FILE_IO, len ? len : 1);
+  *record = (struct JournalRecord){.offset = offset, .len = len, .data = data};
+
+  for (int i = start; i < end; i++) {
+    E.row[i].disk_offset = offset;
+
+    memcpy(data, E.row[i].chars, E.row[i].size);
+    data += E.row[i].size;
+    memcpy(data, editor_newline(), editor_newline_len(i));
+    data += editor_newline_len(i);
+    offset += E.row[i].size + editor_newline_len(i);
+  }
+
+  return offset;
+}
+
+// Writes only the dirty rows of a file that still holds what was last
+// loaded or saved. Clean rows keep their place as long as the rows above
+// them kept their length, past the first one that moved the rest of the
+// file is written. Returns 1 if the whole file has to be written instead,
+// -1 on errors.
+static int editor_save_in_place(int fd, size_t *written) {
+  struct stat st;
+  if (!E.disk_known || fstat(fd, &st) == -1 || st.st_size != E.disk_size ||
+      st.st_mtim.tv_sec != E.disk_mtime ||
+      st.st_mtim.tv_nsec != E.disk_mtime_nsec) {
+    return 1;
+  }
+
+  struct DirtyRanges *dirty = &E.dirty_since_save;
+  struct JournalRecord *records =
+      mem_malloc(MEM_FILE_IO, sizeof(struct JournalRecord) * (dirty->count + 1));
+  int count = 0;
+
+  off_t new_size = E.disk_size;
+  *written = 0;
+
+  for (int i = 0; i < dirty->count; i++) {
+    int start = dirty->ranges[i].start;
+    int end = dirty->ranges[i].end < E.num_rows ? dirty->ranges[i].end
+                                                : E.num_rows;
+
+    // The row above is clean and still where it was on disk
+    off_t offset = start == 0 ? 0
+                              : E.row[start - 1].disk_offset +
+                                    E.row[start - 1].size +
+                                    editor_newline_len(start - 1);
+
+    if (start >= E.num_rows) {
+      // Rows deleted at the end
+      new_size = offset;
+      break;
+    }
+
+    // Rows below that moved take the rest of the file with them
+    off_t record_end = editor_save_record(&records[count], start, end, offset);
+    if (end < E.num_rows && E.row[end].disk_offset != record_end) {
+      mem_free((void *)records[count].data);
+      end = E.num_rows;
+      record_end = editor_save_record(&records[count], start, end, offset);
+    }
+
+    *written += records[count++].len;
+
+    if (end == E.num_rows) {
+      new_size = record_end;
+      break;
     }
+  }
 
-    editor_insert_row(E.num_rows, line, line_len);
+  int result = 0;
+  if (count > 0 || new_size != E.disk_size) {
+    result = journal_commit(fd, E.filename, records, count, new_size);
   }
 
-  free(line);
-  fclose(file_pointer);
+  for (int i = 0; i < count; i++) {
+    mem_free((void *)records[i].data);
+  }
+  mem_free(records);
 
-  E.dirty = 0;
+  if (result == -1) {
+    // Rows may carry offsets that never made it to disk
+    E.disk_known = 0;
+    return -1;
+  }
+
+  editor_mark_saved(fd);
+  return 0;
 }
 
 void editor_save(void) {
+  if (editor_read_only()) {
+    return;
+  }
+
+  // Writing now would cut the file short at the rows read so far
+  if (loader_active()) {
+    editor_set_status_message("Can't save while the file is still loading");
+    return;
+  }
+
   if (E.filename == NULL) {
     E.filename = editor_prompt("Save as: %s (ESC to cancel)", NULL);
     if (E.filename == NULL) {
@@ -84,29 +322,67 @@ void editor_save(void) {
     editor_select_syntax_highlight();
   }
 
-  int len;
-  char *buf = editor_rows_to_string(&len);
+  uint64_t trace_start = perf_trace_begin();
 
   int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-  if (fd == -1)
+  if (fd == -1) {
+    editor_set_status_message("Can't save! I/O error: %s", strerror(errno));
+    perf_trace_end("editor_save", trace_start);
+    return;
+  }
+
+  size_t written;
+  int in_place = editor_save_in_place(fd, &written);
+  if (in_place == -1)
     goto cleanup;
 
-  if (ftruncate(fd, len) == -1)
+  // A journal left by a failed save would redo it over what is written now
+  if (in_place == 1) {
+    journal_discard(E.filename);
+  }
+
+  // The new file takes the old one's place, fd follows it
+  if (in_place == 1 && E.disk_gzip) {
+    int gzip_fd = gzip_write_rows(E.filename, fd, &written);
+    if (gzip_fd == -1)
+      goto cleanup;
+    close(fd);
+    fd = gzip_fd;
+
+    editor_mark_saved(fd);
+    in_place = 0;
+  }
+
+  if (in_place == 0) {
+    close(fd);
+    editor_set_status_message("%zu bytes written to disk", written);
+
+    perf_trace_end("editor_save", trace_start);
+    return;
+  }
+
+  off_t len;
+  if (editor_write_rows(fd, &len) == -1)
     goto cleanup;
-  if (write(fd, buf, len) != len)
+  if (ftruncate(fd, len) == -1)
     goto cleanup;
 
-  close(fd);
-  free(buf);
-  editor_set_status_message("%d bytes written to disk", len);
+  off_t offset = 0;
+  for (int i = 0; i < E.num_rows; i++) {
+    E.row[i].disk_offset = offset;
+    offset += E.row[i].size + editor_newline_len(i);
+  }
+  editor_mark_saved(fd);
 
-  E.dirty = 0;
+  close(fd);
+  editor_set_status_message("%lld bytes written to disk", (long long)len);
 
+  perf_trace_end("editor_save", trace_start);
   return;
 
 cleanup:
-  if (fd != -1)
-    close(fd);
-  free(buf);
+  close(fd);
   editor_set_status_message("Can't save! I/O error: %s", strerror(errno));
+
+  perf_trace_end("editor_save", trace_start);
 }
@@ -1,7 +1,9 @@
 #ifndef FILE_IO_H
 #define FILE_IO_H
 
-char *editor_rows_to_string(int *buf_len);
+int editor_newline_len(int at);
+const char *editor_newline(void);
+char *editor_rows_to_string(size_t *buf_len);
 void editor_open(char *filename);
 void editor_save(void);
 
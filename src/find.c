@@ -0,0 +1,429 @@
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dirty.h"
+#include "editor-io.h"
+#include "editor.h"
+#include "find.h"
+#include "memory.h"
+#include "perf.h"
+#include "row-operations.h"
+#include "terminal.h"
+
+extern struct EditorConfig E;
+
+// Rows counted between looks at the clock and the keyboard
+#define FIND_CHECK_ROWS 1024
+// Rows whose matches are kept for drawing, more than a screen holds
+#define FIND_CACHE_SLOTS 1024
+
+// Rows that hold a query, in file order. Those below scanned are all known.
+// A level starts off checking the rows its parent holds, next is how many of
+// them it has, then goes on through the file from where its parent was.
+struct FindLevel {
+  char *query;
+  int len;
+
+  int *rows;
+  int count;
+  int cap;
+
+  int next;
+  int scanned;
+
+  // Occurrences in the first counted rows
+  int counted;
+  long matches;
+};
+
+// Each level's query extends the one below it. Typing a character only
+// checks the rows of the level below, and deleting one goes back to it, so
+// typing a whole query costs about one pass over the file. Only the top
+// level is ever filled, and just far enough to reach the next match.
+static struct FindLevel *levels = NULL;
+static int num_levels = 0;
+static int cap_levels = 0;
+
+// What the levels were found in. Edits and loaded rows make them stale.
+static unsigned long levels_version = 0;
+static int levels_rows = 0;
+
+// Query whose matches are drawn, for as long as the prompt is up
+static char *shown = NULL;
+static int shown_len = 0;
+static unsigned shown_id = 0;
+
+// Query of the last search that wasn't cancelled
+static char *last_query = NULL;
+
+// Where the shown query matches rows drawn lately. A slot holds one row and
+// is good while neither the row nor the query change, so scrolling over
+// rows already drawn doesn't search them again.
+struct FindRowMatches {
+  int row;
+  unsigned long version;
+  unsigned query_id;
+
+  int *starts;
+  int count;
+  int cap;
+};
+
+static struct FindRowMatches row_cache[FIND_CACHE_SLOTS];
+
+// Number of times query occurs in row, none overlapping. Their render
+// offsets go into starts if it is given.
+static int find_scan_row(EditorRow *row, const char *query, int len,
+                         int **starts, int *cap) {
+  // An empty row may have no render buffer to hand memmem
+  if (row->r_size == 0) {
+    return 0;
+  }
+
+  const char *p = row->r_chars;
+  const char *end = row->r_chars + row->r_size;
+  int count = 0;
+
+  while ((p = memmem(p, end - p, query, len)) != NULL) {
+    if (starts) {
+      if (count == *cap) {
+        *cap = *cap ? *cap * 2 : 8;
+        *starts = mem_realloc(MEM_SEARCH, *starts, sizeof(int) * *cap);
+      }
+      (*starts)[count] = p - row->r_chars;
+    }
+
+    count++;
+    p += len;
+  }
+
+  return count;
+}
+
+static void find_pop_level(void) {
+  struct FindLevel *level = &levels[--num_levels];
+  mem_free(level->query);
+  mem_free(level->rows);
+}
+
+static void find_clear_levels(void) {
+  while (num_levels > 0) {
+    find_pop_level();
+  }
+}
+
+// Checks rows for level i until it holds one past row, has checked them all
+// or has checked limit of them. Returns whether it holds one past row.
+static int find_fill(int i, int row, int limit) {
+  struct FindLevel *level = &levels[i];
+  struct FindLevel *parent = i > 0 ? &levels[i - 1] : NULL;
+
+  while (level->count == 0 || level->rows[level->count - 1] <= row) {
+    int candidate;
+
+    if (limit-- == 0) {
+      return 0;
+    }
+
+    if (parent && level->next < parent->count) {
+      candidate = parent->rows[level->next++];
+    } else if (level->scanned < E.num_rows) {
+      candidate = level->scanned++;
+    } else {
+      return 0;
+    }
+
+    EditorRow *r = &E.row[candidate];
+    if (memmem(r->r_chars, r->r_size, level->query, level->len) == NULL) {
+      continue;
+    }
+
+    if (level->count == level->cap) {
+      level->cap = level->cap ? level->cap * 2 : 64;
+      level->rows = mem_realloc(MEM_SEARCH, level->rows,
+                                sizeof(int) * level->cap);
+    }
+    level->rows[level->count++] = candidate;
+  }
+
+  return 1;
+}
+
+static int find_levels_stale(void) {
+  return levels_version != E.version || levels_rows != E.num_rows;
+}
+
+// Whether level i has been through every row and counted what it found
+static int find_level_done(int i) {
+  struct FindLevel *level = &levels[i];
+
+  return (i == 0 || level->next == levels[i - 1].count) &&
+         level->scanned == E.num_rows && level->counted == level->count;
+}
+
+// Level for query, narrowed down from the longest cached query it extends
+static int find_narrow(const char *query, int len) {
+  if (find_levels_stale()) {
+    find_clear_levels();
+    levels_version = E.version;
+    levels_rows = E.num_rows;
+  }
+
+  while (num_levels > 0) {
+    struct FindLevel *top = &levels[num_levels - 1];
+    if (top->len <= len && memcmp(top->query, query, top->len) == 0) {
+      break;
+    }
+    find_pop_level();
+  }
+
+  if (num_levels > 0 && levels[num_levels - 1].len == len) {
+    return num_levels - 1;
+  }
+
+  if (num_levels == cap_levels) {
+    cap_levels = cap_levels ? cap_levels * 2 : 16;
+    levels = mem_realloc(MEM_SEARCH, levels,
+                         sizeof(struct FindLevel) * cap_levels);
+  }
+
+  struct FindLevel *level = &levels[num_levels];
+  *level = (struct FindLevel){
+      .len = len,
+      .scanned = num_levels > 0 ? levels[num_levels - 1].scanned : 0,
+  };
+  level->query = mem_malloc(MEM_SEARCH, len + 1);
+  memcpy(level->query, query, len + 1);
+
+  return num_levels++;
+}
+
+// Index in level i of the first of its rows past row
+static int find_after(int i, int row) {
+  struct FindLevel *level = &levels[i];
+  int lo = 0;
+  int hi = level->count;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (level->rows[mid] <= row) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+// Row of the match after row, or before it going back, wrapping around at
+// either end. -1 if there is no match at all.
+static int find_next(int i, int row, int direction) {
+  struct FindLevel *level = &levels[i];
+
+  if (direction > 0) {
+    if (find_fill(i, row, INT_MAX)) {
+      return level->rows[find_after(i, row)];
+    }
+    return level->count > 0 ? level->rows[0] : -1;
+  }
+
+  find_fill(i, row - 1, INT_MAX);
+  int before = find_after(i, row - 1) - 1;
+  if (before >= 0) {
+    return level->rows[before];
+  }
+
+  find_fill(i, INT_MAX, INT_MAX);
+  return level->count > 0 ? level->rows[level->count - 1] : -1;
+}
+
+// Matches drawn
+
+// Draws the matches of query over the syntax highlight, none if len is 0
+static void find_show(const char *query, int len) {
+  if (len == shown_len && (len == 0 || memcmp(shown, query, len) == 0)) {
+    return;
+  }
+
+  mem_free(shown);
+  shown = NULL;
+  shown_len = len;
+  if (len > 0) {
+    shown = mem_malloc(MEM_SEARCH, len);
+    memcpy(shown, query, len);
+  }
+
+  // Slots left from an older query never hold this id
+  shown_id++;
+  dirty_add(&E.dirty_since_frame, 0, INT_MAX);
+}
+
+static struct FindRowMatches *find_row_matches(int row) {
+  struct FindRowMatches *slot = &row_cache[row % FIND_CACHE_SLOTS];
+  EditorRow *r = &E.row[row];
+
+  if (slot->query_id != shown_id || slot->row != row ||
+      slot->version != r->version) {
+    slot->row = row;
+    slot->version = r->version;
+    slot->query_id = shown_id;
+    slot->count =
+        find_scan_row(r, shown, shown_len, &slot->starts, &slot->cap);
+  }
+
+  return slot;
+}
+
+// Start of the first match in row ending right of from_rx, INT_MAX if there
+// is none. end is set to where it ends.
+int find_next_match(int row, int from_rx, int *end) {
+  *end = INT_MAX;
+  if (shown_len == 0) {
+    return INT_MAX;
+  }
+
+  struct FindRowMatches *matches = find_row_matches(row);
+  int lo = 0;
+  int hi = matches->count;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (matches->starts[mid] + shown_len <= from_rx) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo == matches->count) {
+    return INT_MAX;
+  }
+
+  *end = matches->starts[lo] + shown_len;
+  return matches->starts[lo];
+}
+
+// The total is counted in the background, while waiting for keys
+int find_count_pending(void) {
+  return shown_len > 0 && (find_levels_stale() || num_levels == 0 ||
+                           !find_level_done(num_levels - 1));
+}
+
+// Counts matches of the shown query for up to budget_ns. Returns 1 once
+// they are all counted.
+int find_count_run(uint64_t budget_ns) {
+  uint64_t start = perf_now_ns();
+  int i = find_narrow(shown, shown_len);
+  struct FindLevel *level = &levels[i];
+
+  while (!find_level_done(i)) {
+    find_fill(i, INT_MAX, FIND_CHECK_ROWS);
+    for (; level->counted < level->count; level->counted++) {
+      level->matches += find_scan_row(&E.row[level->rows[level->counted]],
+                                      shown, shown_len, NULL, NULL);
+    }
+
+    if (perf_now_ns() - start >= budget_ns || terminal_input_pending()) {
+      break;
+    }
+  }
+
+  return find_level_done(i);
+}
+
+// Matches of the shown query in the whole file, -1 until all are counted
+long find_match_count(void) {
+  if (shown_len == 0 || find_count_pending()) {
+    return -1;
+  }
+
+  return levels[num_levels - 1].matches;
+}
+
+// Find
+void editor_find_callback(char *query, int key) {
+  static int last_match = -1;
+  static int direction = 1;
+
+  if (key == '\r' || key == ESC_KEY) {
+    last_match = -1;
+    direction = 1;
+    find_show(NULL, 0);
+    find_clear_levels();
+
+    return;
+  }
+
+  switch (key) {
+  case ARROW_RIGHT:
+  case ARROW_DOWN:
+    direction = 1;
+    break;
+
+  case ARROW_LEFT:
+  case ARROW_UP:
+    direction = -1;
+    break;
+
+  default:
+    last_match = -1;
+    direction = 1;
+  }
+
+  if (last_match == -1) {
+    direction = 1;
+  }
+
+  int len = strlen(query);
+  find_show(query, len);
+  if (len == 0) {
+    return;
+  }
+
+  int current = find_next(find_narrow(query, len), last_match, direction);
+  if (current == -1) {
+    return;
+  }
+
+  EditorRow *row = &E.row[current];
+  char *match = memmem(row->r_chars, row->r_size, query, len);
+
+  last_match = current;
+  E.cursor_y = current;
+  E.cursor_x = editor_row_render_x_to_cursor_x(row, match - row->r_chars);
+  E.row_off = E.num_rows;
+}
+
+void editor_find(void) {
+  int saved_cx = E.cursor_x;
+  int saved_cy = E.cursor_y;
+  int saved_col_off = E.col_off;
+  int saved_row_off = E.row_off;
+
+  char *query = editor_prompt("Search: %s (ESC/Arrows/Enter to cancel)",
+                              editor_find_callback);
+  if (query == NULL) {
+    E.cursor_x = saved_cx;
+    E.cursor_y = saved_cy;
+    E.col_off = saved_col_off;
+    E.row_off = saved_row_off;
+
+    return;
+  }
+
+  mem_free(last_query);
+  last_query = NULL;
+  if (query[0] != '\0') {
+    last_query = mem_malloc(MEM_SEARCH, strlen(query) + 1);
+    strcpy(last_query, query);
+  }
+
+  free(query);
+}
+
+// NULL if nothing was searched for yet
+const char *find_last_query(void) { return last_query; }
@@ -1,6 +1,17 @@
 #ifndef FIND_H
 #define FIND_H
 
+#include <stdint.h>
+
+// Longest stretch of background counting between looks at the keyboard
+#define FIND_SLICE_NS 4000000ull
+
+int find_next_match(int row, int from_rx, int *end);
+int find_count_pending(void);
+int find_count_run(uint64_t budget_ns);
+long find_match_count(void);
+const char *find_last_query(void);
+
 void editor_find_callback(char *query, int key);
 void editor_find(void);
 
@@ -0,0 +1,238 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "editor.h"
+#include "file-io.h"
+#include "gzip.h"
+#include "memory.h"
+
+extern struct EditorConfig E;
+
+// Bytes handed to zlib at a time on either side when saving
+#define GZIP_BUF (1 << 16)
+
+struct GzipReader {
+  z_stream z;
+  const char *data;
+  size_t size;
+};
+
+// Whether data starts like a gzip member
+int gzip_detect(const char *data, size_t size) {
+  return size >= 2 && (unsigned char)data[0] == 0x1f &&
+         (unsigned char)data[1] == 0x8b;
+}
+
+struct GzipReader *gzip_reader_open(const char *data, size_t size) {
+  struct GzipReader *reader = mem_malloc(MEM_FILE_IO, sizeof(*reader));
+  *reader = (struct GzipReader){.data = data, .size = size};
+
+  // 16 on top of the window bits reads the gzip wrapper
+  if (inflateInit2(&reader->z, 15 + 16) != Z_OK) {
+    mem_free(reader);
+    return NULL;
+  }
+
+  reader->z.next_in = (Bytef *)data;
+  return reader;
+}
+
+// Inflates up to cap bytes into out, and sets len to how many there are.
+// Members written one after the other are read as one file. Returns 1
+// while there is more to come, 0 at the end and -1 if the data is corrupt
+// or cut short.
+int gzip_inflate(struct GzipReader *reader, char *out, size_t cap,
+                 size_t *len) {
+  z_stream *z = &reader->z;
+  *len = 0;
+
+  while (*len < cap) {
+    size_t left = reader->size - gzip_consumed(reader);
+    z->avail_in = left < UINT_MAX ? left : UINT_MAX;
+    z->next_out = (Bytef *)&out[*len];
+    z->avail_out = cap - *len < UINT_MAX ? cap - *len : UINT_MAX;
+
+    unsigned avail_out = z->avail_out;
+    int status = inflate(z, Z_NO_FLUSH);
+    *len += avail_out - z->avail_out;
+
+    if (status == Z_STREAM_END) {
+      // Anything after the last member is ignored, as gzip -d does
+      if (!gzip_detect((const char *)z->next_in,
+                       reader->size - gzip_consumed(reader))) {
+        return 0;
+      }
+      if (inflateReset(z) != Z_OK) {
+        return -1;
+      }
+      continue;
+    }
+
+    if (status != Z_OK) {
+      return -1;
+    }
+  }
+
+  return 1;
+}
+
+// Bytes of compressed data read so far
+size_t gzip_consumed(struct GzipReader *reader) {
+  return (const char *)reader->z.next_in - reader->data;
+}
+
+void gzip_reader_close(struct GzipReader *reader) {
+  if (reader == NULL) {
+    return;
+  }
+
+  inflateEnd(&reader->z);
+  mem_free(reader);
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+  const char *p = data;
+
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+// Deflates out what zlib holds and writes it, finishing the stream if flush
+// says so
+static int gzip_deflate(z_stream *z, int fd, char *out, int flush,
+                        size_t *written) {
+  do {
+    z->next_out = (Bytef *)out;
+    z->avail_out = GZIP_BUF;
+
+    int status = deflate(z, flush);
+    if (status == Z_STREAM_ERROR) {
+      return -1;
+    }
+
+    size_t len = GZIP_BUF - z->avail_out;
+    if (write_all(fd, out, len) == -1) {
+      return -1;
+    }
+    *written += len;
+  } while (z->avail_out == 0);
+
+  return 0;
+}
+
+// Buffers len bytes of text for zlib, deflating whenever the buffer fills
+static int gzip_feed(z_stream *z, int fd, char *in, size_t *in_len,
+                     char *out, const char *text, size_t len,
+                     size_t *written) {
+  while (len > 0) {
+    size_t n = GZIP_BUF - *in_len < len ? GZIP_BUF - *in_len : len;
+    memcpy(&in[*in_len], text, n);
+    *in_len += n;
+    text += n;
+    len -= n;
+
+    if (*in_len == GZIP_BUF) {
+      z->next_in = (Bytef *)in;
+      z->avail_in = *in_len;
+      *in_len = 0;
+
+      if (gzip_deflate(z, fd, out, Z_NO_FLUSH, written) == -1) {
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+// Writes the rows to the empty file fd, compressed as a single gzip member.
+// Rows are fed to zlib a buffer at a time, the text is never whole in
+// memory.
+static int gzip_deflate_rows(int fd, size_t *written) {
+  z_stream z = {0};
+  if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return -1;
+  }
+
+  char *in = mem_malloc(MEM_FILE_IO, GZIP_BUF);
+  char *out = mem_malloc(MEM_FILE_IO, GZIP_BUF);
+  size_t in_len = 0;
+  int result = 0;
+
+  *written = 0;
+  for (int i = 0; i < E.num_rows && result == 0; i++) {
+    result = gzip_feed(&z, fd, in, &in_len, out, E.row[i].chars,
+                       E.row[i].size, written);
+    if (result == 0) {
+      result = gzip_feed(&z, fd, in, &in_len, out, editor_newline(),
+                         editor_newline_len(i), written);
+    }
+  }
+
+  if (result == 0) {
+    z.next_in = (Bytef *)in;
+    z.avail_in = in_len;
+    result = gzip_deflate(&z, fd, out, Z_FINISH, written);
+  }
+
+  deflateEnd(&z);
+  mem_free(in);
+  mem_free(out);
+  return result;
+}
+
+// Compresses the rows into a file beside filename and renames it over once
+// it is synced, so a save cut short leaves the old file as it was. The new
+// one takes the permissions of fd, the old one. Returns it open, or -1.
+int gzip_write_rows(const char *filename, int fd, size_t *written) {
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return -1;
+  }
+
+  size_t tmp_len = strlen(filename) + sizeof(".kilo-save");
+  char *tmp_path = mem_malloc(MEM_FILE_IO, tmp_len);
+  snprintf(tmp_path, tmp_len, "%s.kilo-save", filename);
+
+  int tmp_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (tmp_fd == -1) {
+    mem_free(tmp_path);
+    return -1;
+  }
+
+  if (gzip_deflate_rows(tmp_fd, written) == -1 ||
+      fchmod(tmp_fd, st.st_mode & 07777) == -1 || fsync(tmp_fd) == -1 ||
+      rename(tmp_path, filename) == -1) {
+    int saved_errno = errno;
+    close(tmp_fd);
+    unlink(tmp_path);
+    mem_free(tmp_path);
+
+    errno = saved_errno;
+    return -1;
+  }
+
+  mem_free(tmp_path);
+  return tmp_fd;
+}
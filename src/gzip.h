@@ -0,0 +1,21 @@
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <stddef.h>
+
+// Files stored gzip-compressed, inflated as a stream from memory when they
+// are loaded and deflated row by row when they are saved
+
+struct GzipReader;
+
+int gzip_detect(const char *data, size_t size);
+
+struct GzipReader *gzip_reader_open(const char *data, size_t size);
+int gzip_inflate(struct GzipReader *reader, char *out, size_t cap,
+                 size_t *len);
+size_t gzip_consumed(struct GzipReader *reader);
+void gzip_reader_close(struct GzipReader *reader);
+
+int gzip_write_rows(const char *filename, int fd, size_t *written);
+
+#endif // GZIP_H
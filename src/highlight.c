@@ -0,0 +1,361 @@
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "brackets.h"
+#include "dirty.h"
+#include "editor.h"
+#include "highlight.h"
+#include "line-map.h"
+#include "memory.h"
+#include "perf.h"
+#include "pool.h"
+#include "row-operations.h"
+#include "terminal.h"
+
+extern struct EditorConfig E;
+
+// Fewest rows worth highlighting on their own thread
+#define HIGHLIGHT_MIN_CHUNK 4096
+#define HIGHLIGHT_MAX_CHUNKS 64
+
+// Rows lexed between looks at the clock and the keyboard
+#define HIGHLIGHT_CHECK_ROWS 64
+
+// Rows whose entry state may have changed since they were last lexed,
+// sorted and without duplicates
+static int *pending = NULL;
+static int num_pending = 0;
+static int cap_pending = 0;
+
+// Rows from here on may not be lexed yet. Their comment state is already
+// right, so each can be lexed on its own whenever it is needed.
+static int deferred_from = INT_MAX;
+
+// Index of the first pending row at or after at
+static int highlight_pending_find(int at) {
+  int lo = 0;
+  int hi = num_pending;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (pending[mid] < at) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+// Whole-file highlighting
+
+// The only state a row inherits from the one above is whether it starts
+// inside a multiline comment. Every chunk but the first is lexed as if it
+// started outside a comment, and again from inside one until both passes
+// end a row in the same state: from there on their results are identical.
+// A sequential pass then keeps whichever result matches the real state.
+struct HighlightChunk {
+  int start;
+  int end;
+  int in_comment;
+  int speculative;
+
+  // Rows lexed as starting inside a comment
+  uint8_t **alt_hl;
+  int *alt_open_comment;
+  int alt_rows;
+  int alt_cap;
+};
+
+static void *highlight_chunk(void *arg) {
+  struct HighlightChunk *chunk = arg;
+
+  int in_comment = chunk->in_comment;
+  for (int i = chunk->start; i < chunk->end; i++) {
+    in_comment = editor_highlight_row(&E.row[i], in_comment);
+    E.row[i].hl_open_comment = in_comment;
+  }
+
+  if (!chunk->speculative) {
+    return NULL;
+  }
+
+  in_comment = 1;
+  for (int i = chunk->start; i < chunk->end; i++) {
+    EditorRow alt = E.row[i];
+    alt.hl = NULL;
+    alt.brackets = NULL;
+    in_comment = editor_highlight_row(&alt, in_comment);
+
+    int n = chunk->alt_rows++;
+    if (n == chunk->alt_cap) {
+      chunk->alt_cap = chunk->alt_cap ? chunk->alt_cap * 2 : 16;
+      chunk->alt_hl = mem_realloc(MEM_HIGHLIGHT, chunk->alt_hl,
+                                  sizeof(uint8_t *) * chunk->alt_cap);
+      chunk->alt_open_comment =
+          mem_realloc(MEM_HIGHLIGHT, chunk->alt_open_comment,
+                      sizeof(int) * chunk->alt_cap);
+    }
+
+    chunk->alt_hl[n] = alt.hl;
+    chunk->alt_open_comment[n] = in_comment;
+
+    if (in_comment == E.row[i].hl_open_comment) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+// Keeps the speculative rows if the chunk really starts inside a comment
+static void highlight_fix_up(struct HighlightChunk *chunk) {
+  int in_comment = E.row[chunk->start - 1].hl_open_comment;
+
+  for (int j = 0; j < chunk->alt_rows; j++) {
+    EditorRow *row = &E.row[chunk->start + j];
+
+    if (in_comment) {
+      mem_free(row->hl);
+      row->hl = chunk->alt_hl[j];
+      row->hl_open_comment = chunk->alt_open_comment[j];
+    } else {
+      mem_free(chunk->alt_hl[j]);
+    }
+  }
+
+  mem_free(chunk->alt_hl);
+  mem_free(chunk->alt_open_comment);
+}
+
+// Highlights every row from at to the end, splitting the work across cores
+void editor_highlight_from(int at) {
+  uint64_t trace_start = perf_trace_begin();
+
+  struct HighlightChunk chunks[HIGHLIGHT_MAX_CHUNKS];
+  int rows = E.num_rows - at;
+  int num_chunks = rows / HIGHLIGHT_MIN_CHUNK + 1;
+
+  if (num_chunks > parallel_workers()) {
+    num_chunks = parallel_workers();
+  }
+  if (num_chunks > HIGHLIGHT_MAX_CHUNKS) {
+    num_chunks = HIGHLIGHT_MAX_CHUNKS;
+  }
+
+  // Without a syntax a row has no comments to carry over
+  if (E.syntax == NULL) {
+    num_chunks = 1;
+  }
+
+  for (int i = 0; i < num_chunks; i++) {
+    chunks[i] = (struct HighlightChunk){
+        .start = at + (long)rows * i / num_chunks,
+        .end = at + (long)rows * (i + 1) / num_chunks,
+        .in_comment = i == 0 && at > 0 && E.row[at - 1].hl_open_comment,
+        .speculative = i > 0,
+    };
+  }
+
+  parallel_run(highlight_chunk, chunks, sizeof(struct HighlightChunk),
+               num_chunks);
+
+  for (int i = 1; i < num_chunks; i++) {
+    highlight_fix_up(&chunks[i]);
+  }
+
+  // Everything from at on is up to date now
+  num_pending = highlight_pending_find(at);
+  if (at <= deferred_from) {
+    deferred_from = INT_MAX;
+  }
+  dirty_add(&E.dirty_since_frame, at, E.num_rows);
+  brackets_rows_changed(at, E.num_rows);
+
+  perf_trace_end("editor_highlight_from", trace_start);
+}
+
+// Scheduling
+
+static void highlight_pending_remove(int i) {
+  memmove(&pending[i], &pending[i + 1], sizeof(int) * (num_pending - i - 1));
+  num_pending--;
+}
+
+// Queues row at to be lexed again with the state its row above ends in
+void highlight_schedule(int at) {
+  if (at < 0 || at >= E.num_rows) {
+    return;
+  }
+
+  int i = highlight_pending_find(at);
+  if (i < num_pending && pending[i] == at) {
+    return;
+  }
+
+  if (num_pending == cap_pending) {
+    cap_pending = cap_pending ? cap_pending * 2 : 16;
+    pending = mem_realloc(MEM_HIGHLIGHT, pending, sizeof(int) * cap_pending);
+  }
+
+  memmove(&pending[i + 1], &pending[i], sizeof(int) * (num_pending - i));
+  pending[i] = at;
+  num_pending++;
+}
+
+void highlight_rows_inserted(int at, int count) {
+  for (int i = highlight_pending_find(at); i < num_pending; i++) {
+    pending[i] += count;
+  }
+
+  if (at < deferred_from && deferred_from != INT_MAX) {
+    deferred_from += count;
+  }
+}
+
+void highlight_rows_deleted(int at, int count) {
+  int out = highlight_pending_find(at);
+
+  for (int i = out; i < num_pending; i++) {
+    if (pending[i] >= at + count) {
+      pending[out++] = pending[i] - count;
+    }
+  }
+  num_pending = out;
+
+  if (at < deferred_from && deferred_from != INT_MAX) {
+    deferred_from -= deferred_from - at < count ? deferred_from - at : count;
+  }
+
+  // The row after the gap follows a different row now
+  highlight_schedule(at);
+}
+
+int highlight_pending(void) {
+  return num_pending > 0 || deferred_from < E.num_rows;
+}
+
+// Deferred rows
+
+// Takes the comment states the rows from at on already hold as right, and
+// leaves lexing them for when they are shown or the editor is idle
+void highlight_defer_from(int at) {
+  if (at < deferred_from) {
+    deferred_from = at;
+  }
+
+  num_pending = highlight_pending_find(at);
+}
+
+static int highlight_lexed(EditorRow *row) {
+  return row->hl != NULL || row->r_size == 0;
+}
+
+// Lexes row at if it was deferred, before anything reads its highlight
+void highlight_ensure(int at) {
+  if (at < deferred_from || at >= E.num_rows || highlight_lexed(&E.row[at])) {
+    return;
+  }
+
+  int in_comment = at > 0 && E.row[at - 1].hl_open_comment;
+  if (editor_highlight_row(&E.row[at], in_comment) !=
+      E.row[at].hl_open_comment) {
+    E.row[at].hl_open_comment = !E.row[at].hl_open_comment;
+    highlight_schedule(at + 1);
+  }
+
+  dirty_add(&E.dirty_since_frame, at, at + 1);
+  brackets_rows_changed(at, at + 1);
+}
+
+// Lexes the i-th pending row and moves its frontier down if the state it
+// passes on changed. Returns the row lexed.
+static int highlight_step(int i) {
+  int at = pending[i];
+
+  if (at >= E.num_rows) {
+    highlight_pending_remove(i);
+    return at;
+  }
+
+  EditorRow *row = &E.row[at];
+  int in_comment = at > 0 && E.row[at - 1].hl_open_comment;
+  in_comment = editor_highlight_row(row, in_comment);
+
+  int changed = row->hl_open_comment != in_comment;
+  row->hl_open_comment = in_comment;
+  dirty_add(&E.dirty_since_frame, at, at + 1);
+  brackets_rows_changed(at, at + 1);
+
+  if (!changed || at + 1 >= E.num_rows ||
+      (i + 1 < num_pending && pending[i + 1] == at + 1)) {
+    highlight_pending_remove(i);
+  } else {
+    pending[i] = at + 1;
+  }
+
+  return at;
+}
+
+// Row right below the last one on screen
+static int highlight_screen_end(void) {
+  long top = line_map_visual(E.row_off) + E.wrap_off;
+  return line_map_row_at(top + E.screen_rows - 1) + 1;
+}
+
+// Brings the rows on screen up to date, frontiers above them are left to
+// highlight_run
+void highlight_visible(void) {
+  int bottom = highlight_screen_end();
+
+  int i;
+  while ((i = highlight_pending_find(E.row_off)) < num_pending &&
+         pending[i] < bottom) {
+    highlight_step(i);
+  }
+
+  for (int at = E.row_off > deferred_from ? E.row_off : deferred_from;
+       at < bottom && at < E.num_rows; at++) {
+    highlight_ensure(at);
+  }
+}
+
+// Lexes every frontier to the end, deferred rows stay as they are
+void highlight_settle(void) {
+  while (num_pending > 0) {
+    highlight_step(0);
+  }
+}
+
+// Lexes pending rows top down until budget_ns is spent or a key is waiting.
+// Returns whether any row on screen changed.
+int highlight_run(uint64_t budget_ns) {
+  uint64_t trace_start = perf_trace_begin();
+  uint64_t start = perf_now_ns();
+
+  int on_screen = 0;
+  int rows = 0;
+  int bottom = highlight_screen_end();
+
+  while (highlight_pending()) {
+    int at;
+    if (num_pending > 0) {
+      at = highlight_step(0);
+    } else {
+      at = deferred_from;
+      highlight_ensure(at);
+      deferred_from = at + 1 < E.num_rows ? at + 1 : INT_MAX;
+    }
+    on_screen |= at >= E.row_off && at < bottom;
+
+    if (++rows % HIGHLIGHT_CHECK_ROWS == 0 &&
+        (perf_now_ns() - start >= budget_ns || terminal_input_pending())) {
+      break;
+    }
+  }
+
+  perf_trace_end("highlight_run", trace_start);
+  return on_screen;
+}
@@ -0,0 +1,21 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include <stdint.h>
+
+// Longest stretch of background highlighting between looks at the keyboard
+#define HIGHLIGHT_SLICE_NS 4000000ull
+
+void editor_highlight_from(int at);
+
+void highlight_schedule(int at);
+void highlight_rows_inserted(int at, int count);
+void highlight_rows_deleted(int at, int count);
+int highlight_pending(void);
+void highlight_defer_from(int at);
+void highlight_ensure(int at);
+void highlight_visible(void);
+void highlight_settle(void);
+int highlight_run(uint64_t budget_ns);
+
+#endif // HIGHLIGHT_H
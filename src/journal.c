@@ -0,0 +1,390 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "memory.h"
+
+#define JOURNAL_MAGIC "KILOJNL2"
+#define JOURNAL_MAGIC_LEN 8
+
+// Files up to this size have their untouched bytes hashed whole, bigger
+// ones by samples
+#define JOURNAL_HASH_WHOLE (1 << 20)
+#define JOURNAL_HASH_SAMPLES 64
+#define JOURNAL_HASH_SAMPLE_LEN 4096
+
+// Layout, in host byte order: magic, new size, record count, checksum of
+// everything after the header, the hash of the bytes below base_len that
+// no record covers, then per record its offset, length and data
+struct JournalHeader {
+  char magic[JOURNAL_MAGIC_LEN];
+  uint64_t new_size;
+  uint64_t count;
+  uint64_t checksum;
+  uint64_t base_len;
+  uint64_t base_hash;
+};
+
+struct JournalRecordHeader {
+  uint64_t offset;
+  uint64_t len;
+};
+
+static char *journal_path(const char *filename) {
+  static const char suffix[] = ".kilo-journal";
+
+  size_t len = strlen(filename);
+  char *path = mem_malloc(MEM_FILE_IO, len + sizeof(suffix));
+  memcpy(path, filename, len);
+  memcpy(&path[len], suffix, sizeof(suffix));
+
+  return path;
+}
+
+// Syncs the directory holding path, which is what makes creating or
+// unlinking the file there survive a crash
+static int journal_sync_dir(const char *path) {
+  const char *slash = strrchr(path, '/');
+  char *dir;
+
+  if (slash == NULL) {
+    dir = mem_malloc(MEM_FILE_IO, 2);
+    memcpy(dir, ".", 2);
+  } else {
+    size_t len = slash == path ? 1 : (size_t)(slash - path);
+    dir = mem_malloc(MEM_FILE_IO, len + 1);
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+  }
+
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  mem_free(dir);
+  if (fd == -1) {
+    return -1;
+  }
+
+  int r = fsync(fd);
+  int saved_errno = errno;
+  close(fd);
+
+  errno = saved_errno;
+  return r;
+}
+
+static uint64_t journal_checksum(uint64_t hash, const void *data, size_t len) {
+  const unsigned char *p = data;
+
+  for (size_t i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 1099511628211ull;
+  }
+
+  return hash;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+  const char *p = data;
+
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+static int pwrite_all(int fd, const void *data, size_t len, off_t offset) {
+  const char *p = data;
+
+  while (len > 0) {
+    ssize_t n = pwrite(fd, p, len, offset);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    p += n;
+    len -= n;
+    offset += n;
+  }
+
+  return 0;
+}
+
+static int pread_all(int fd, void *data, size_t len, off_t offset) {
+  char *p = data;
+
+  while (len > 0) {
+    ssize_t n = pread(fd, p, len, offset);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+
+    p += n;
+    len -= n;
+    offset += n;
+  }
+
+  return 0;
+}
+
+// Hashes the bytes of fd below len that none of the records, sorted by
+// offset, cover: all of them in small files, evenly spread samples in big
+// ones. A save leaves those bytes alone, so they are the same before it,
+// halfway through it and after it, and only another writer changes them.
+static int journal_fingerprint(int fd, struct JournalRecord *records,
+                               int count, off_t len, uint64_t *fingerprint) {
+  size_t sample_len = len < JOURNAL_HASH_WHOLE ? len : JOURNAL_HASH_SAMPLE_LEN;
+  int samples = len < JOURNAL_HASH_WHOLE ? 1 : JOURNAL_HASH_SAMPLES;
+
+  char *buf = mem_malloc(MEM_FILE_IO, sample_len ? sample_len : 1);
+  uint64_t hash = 14695981039346656037ull;
+  int r = 0;
+
+  for (int i = 0; i < samples; i++) {
+    off_t start = samples == 1 ? 0 : (len - sample_len) / (samples - 1) * i;
+    off_t end = start + sample_len;
+
+    if (pread_all(fd, buf, sample_len, start) == -1) {
+      mem_free(buf);
+      return -1;
+    }
+
+    while (r < count && records[r].offset + (off_t)records[r].len <= start) {
+      r++;
+    }
+
+    off_t at = start;
+    for (int j = r; j < count && records[j].offset < end; j++) {
+      if (records[j].offset > at) {
+        hash = journal_checksum(hash, &buf[at - start],
+                                records[j].offset - at);
+      }
+
+      off_t record_end = records[j].offset + records[j].len;
+      if (record_end > at) {
+        at = record_end;
+      }
+    }
+    if (at < end) {
+      hash = journal_checksum(hash, &buf[at - start], end - at);
+    }
+  }
+
+  mem_free(buf);
+  *fingerprint = hash;
+  return 0;
+}
+
+static int journal_apply(int fd, struct JournalRecord *records, int count,
+                         off_t new_size) {
+  for (int i = 0; i < count; i++) {
+    if (pwrite_all(fd, records[i].data, records[i].len, records[i].offset) ==
+        -1) {
+      return -1;
+    }
+  }
+
+  if (ftruncate(fd, new_size) == -1) {
+    return -1;
+  }
+
+  return fsync(fd);
+}
+
+// Writes the records, sorted by offset, into fd and truncates it to
+// new_size, journaling them first. Returns -1 with errno set if the file
+// was left unchanged or the journal is still there to finish the save.
+int journal_commit(int fd, const char *filename, struct JournalRecord *records,
+                   int count, off_t new_size) {
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return -1;
+  }
+
+  struct JournalHeader header = {
+      .magic = JOURNAL_MAGIC,
+      .new_size = new_size,
+      .count = count,
+      .checksum = 14695981039346656037ull,
+      .base_len = st.st_size < new_size ? st.st_size : new_size,
+  };
+
+  if (journal_fingerprint(fd, records, count, header.base_len,
+                          &header.base_hash) == -1) {
+    return -1;
+  }
+
+  for (int i = 0; i < count; i++) {
+    struct JournalRecordHeader rec = {records[i].offset, records[i].len};
+    header.checksum = journal_checksum(header.checksum, &rec, sizeof(rec));
+    header.checksum =
+        journal_checksum(header.checksum, records[i].data, records[i].len);
+  }
+
+  char *path = journal_path(filename);
+  int journal = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (journal == -1) {
+    mem_free(path);
+    return -1;
+  }
+
+  int failed = write_all(journal, &header, sizeof(header)) == -1;
+  for (int i = 0; i < count && !failed; i++) {
+    struct JournalRecordHeader rec = {records[i].offset, records[i].len};
+    failed = write_all(journal, &rec, sizeof(rec)) == -1 ||
+             write_all(journal, records[i].data, records[i].len) == -1;
+  }
+
+  failed = failed || fsync(journal) == -1;
+  int saved_errno = errno;
+  close(journal);
+
+  // The journal's name has to be on disk as well before the file is
+  // touched, or a crash could leave a torn file and no journal
+  if (failed || journal_sync_dir(path) == -1) {
+    saved_errno = failed ? saved_errno : errno;
+    unlink(path);
+    mem_free(path);
+
+    errno = saved_errno;
+    return -1;
+  }
+
+  // From here on the journal can finish what this starts
+  if (journal_apply(fd, records, count, new_size) == -1) {
+    mem_free(path);
+    return -1;
+  }
+
+  unlink(path);
+  journal_sync_dir(path);
+  mem_free(path);
+
+  return 0;
+}
+
+// Drops the journal of an interrupted save, for a save that writes the
+// whole file anew
+void journal_discard(const char *filename) {
+  char *path = journal_path(filename);
+  if (unlink(path) == 0) {
+    journal_sync_dir(path);
+  }
+  mem_free(path);
+}
+
+// Finishes a save interrupted after its journal was synced and drops a
+// journal that was never completed. A journal written for the file as it
+// was before another program changed it is dropped too, its records would
+// land in the wrong places. Returns 1 if a save was finished, 2 if a
+// journal was dropped for that.
+int journal_recover(const char *filename) {
+  char *path = journal_path(filename);
+
+  int journal = open(path, O_RDONLY);
+  if (journal == -1) {
+    mem_free(path);
+    return errno == ENOENT ? 0 : -1;
+  }
+
+  off_t size = lseek(journal, 0, SEEK_END);
+  char *buf = size > 0 ? mem_malloc(MEM_FILE_IO, size) : NULL;
+
+  int complete = size >= (off_t)sizeof(struct JournalHeader) &&
+                 pread(journal, buf, size, 0) == size;
+  close(journal);
+
+  struct JournalHeader header;
+  struct JournalRecord *records = NULL;
+  int count = 0;
+
+  if (complete) {
+    memcpy(&header, buf, sizeof(header));
+    complete = memcmp(header.magic, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) == 0;
+  }
+
+  if (complete) {
+    uint64_t checksum = 14695981039346656037ull;
+    off_t at = sizeof(header);
+
+    records = mem_malloc(MEM_FILE_IO, sizeof(struct JournalRecord) *
+                                          (header.count ? header.count : 1));
+
+    while ((uint64_t)count < header.count) {
+      struct JournalRecordHeader rec;
+      if (size - at < (off_t)sizeof(rec)) {
+        break;
+      }
+      memcpy(&rec, &buf[at], sizeof(rec));
+      checksum = journal_checksum(checksum, &rec, sizeof(rec));
+      at += sizeof(rec);
+
+      if ((uint64_t)(size - at) < rec.len) {
+        break;
+      }
+      checksum = journal_checksum(checksum, &buf[at], rec.len);
+
+      records[count++] =
+          (struct JournalRecord){rec.offset, rec.len, &buf[at]};
+      at += rec.len;
+    }
+
+    complete = (uint64_t)count == header.count && checksum == header.checksum;
+  }
+
+  int result = 0;
+  if (complete) {
+    int fd = open(filename, O_RDWR);
+    uint64_t base_hash;
+
+    if (fd == -1) {
+      result = -1;
+    } else if (journal_fingerprint(fd, records, count, header.base_len,
+                                   &base_hash) == -1 ||
+               base_hash != header.base_hash) {
+      result = 2;
+    } else {
+      result = journal_apply(fd, records, count, header.new_size) == 0 ? 1
+                                                                       : -1;
+    }
+
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  // A journal that doesn't check out was cut short before the file was
+  // touched, so it is simply dropped
+  if (result != -1) {
+    unlink(path);
+    journal_sync_dir(path);
+  }
+
+  mem_free(records);
+  mem_free(buf);
+  mem_free(path);
+
+  return result;
+}
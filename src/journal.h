@@ -0,0 +1,23 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// A redo journal for saves that write into the existing file. The changes
+// go to <file>.kilo-journal and are synced before the file is touched, so
+// a save cut short is finished by journal_recover on the next open, as long
+// as nothing else wrote to the file in between.
+
+struct JournalRecord {
+  off_t offset;
+  size_t len;
+  const char *data;
+};
+
+int journal_commit(int fd, const char *filename, struct JournalRecord *records,
+                   int count, off_t new_size);
+void journal_discard(const char *filename);
+int journal_recover(const char *filename);
+
+#endif // JOURNAL_H
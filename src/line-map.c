@@ -0,0 +1,739 @@
+#include <limits.h>
+#include <string.h>
+
+#include "brackets.h"
+#include "dirty.h"
+#include "editor-io.h"
+#include "editor.h"
+#include "highlight.h"
+#include "line-map.h"
+#include "memory.h"
+#include "treap.h"
+
+extern struct EditorConfig E;
+
+// One tree node per row, in row order. covered is how many folds hide the
+// row, less the adds the nodes above it still have to hand down. Folding a
+// run of rows splits it off and adds to its top node, O(log n) whatever
+// its length. A subtree keeps the fewest covers of its rows and the lines
+// of the rows with that many, which are the lines it shows when the fewest
+// is 0. The widest row of a subtree tells whether any of its rows wraps at
+// all.
+struct LineNode {
+  int width;
+  int max_width;
+  int lines;
+  int covered;
+  int add;
+  int min_covered;
+  long min_lines;
+
+  // Folds whose first and last hidden rows this is, -1 for none
+  int first_of;
+  int last_of;
+};
+
+static void line_map_pull(int t);
+static void line_map_push(int t);
+static void line_map_grow(int cap);
+
+static struct LineNode *nodes = NULL;
+static struct Treap tree = {
+    .num_nodes = 1,
+    .seed = 88172645u,
+    .tag = MEM_ROW_INDEX,
+    .pull = line_map_pull,
+    .push = line_map_push,
+    .grow = line_map_grow,
+};
+
+// Wrapping the node line counts follow, which may lag behind E's until the
+// next lookup
+static int tree_wrap = 0;
+static int tree_cols = 0;
+
+// A fold holds on to the nodes of the first and last rows it hides, and
+// moves with them as rows come and go above it. The row above the first is
+// its header. Folds may nest.
+struct Fold {
+  int first;
+  int last;
+  int next_first;
+  int next_last;
+  int lost;
+};
+
+static struct Fold *folds = NULL;
+static int num_fold_ids = 0;
+static int cap_fold_ids = 0;
+static int free_folds = -1;
+
+// Folds sorted by their first row, the outer of two with the same first
+// row first
+static int *order = NULL;
+static int num_folds = 0;
+static int cap_order = 0;
+
+// Tree
+
+// Lines a shown row takes up, at least one even when empty
+int line_map_row_lines(int row) {
+  if (!E.soft_wrap || E.screen_cols == 0 || E.row[row].r_size == 0) {
+    return 1;
+  }
+
+  return (E.row[row].r_size + E.screen_cols - 1) / E.screen_cols;
+}
+
+// Widest row that still takes one line in the tree
+static int line_map_limit(void) {
+  return tree_wrap && tree_cols > 0 ? tree_cols : INT_MAX;
+}
+
+static int line_map_lines(int width) {
+  if (width == 0 || width <= line_map_limit()) {
+    return 1;
+  }
+
+  return (width + tree_cols - 1) / tree_cols;
+}
+
+// Lines subtree t shows, add being what the nodes above it hand down
+static long line_map_shown(int t, int add) {
+  return t && nodes[t].min_covered + add == 0 ? nodes[t].min_lines : 0;
+}
+
+static void line_map_apply(int t, int delta) {
+  if (t) {
+    nodes[t].covered += delta;
+    nodes[t].min_covered += delta;
+    nodes[t].add += delta;
+  }
+}
+
+static void line_map_push(int t) {
+  if (nodes[t].add) {
+    line_map_apply(tree.nodes[t].left, nodes[t].add);
+    line_map_apply(tree.nodes[t].right, nodes[t].add);
+    nodes[t].add = 0;
+  }
+}
+
+// The children's counts don't have t's add in them yet
+static void line_map_pull(int t) {
+  struct LineNode *n = &nodes[t];
+  int children[2] = {tree.nodes[t].left, tree.nodes[t].right};
+
+  n->max_width = n->width;
+  n->min_covered = n->covered;
+  n->min_lines = n->lines;
+
+  for (int i = 0; i < 2; i++) {
+    int c = children[i];
+    if (c == 0) {
+      continue;
+    }
+
+    int covered = nodes[c].min_covered + n->add;
+    if (nodes[c].max_width > n->max_width) {
+      n->max_width = nodes[c].max_width;
+    }
+
+    if (covered < n->min_covered) {
+      n->min_covered = covered;
+      n->min_lines = nodes[c].min_lines;
+    } else if (covered == n->min_covered) {
+      n->min_lines += nodes[c].min_lines;
+    }
+  }
+}
+
+static void line_map_grow(int cap) {
+  nodes = mem_realloc(MEM_ROW_INDEX, nodes, sizeof(struct LineNode) * cap);
+}
+
+// Gives node t the width of row *arg + i, or of an empty row if *arg is -1
+static void line_map_fill(int t, int i, void *arg) {
+  int first = *(int *)arg;
+  int width = first < 0 ? 0 : E.row[first + i].r_size;
+  int lines = line_map_lines(width);
+
+  nodes[t] = (struct LineNode){.width = width,
+                               .max_width = width,
+                               .lines = lines,
+                               .min_lines = lines,
+                               .first_of = -1,
+                               .last_of = -1};
+}
+
+// Folds hiding the row of node t
+static int line_map_covered(int t) {
+  int covered = nodes[t].covered;
+
+  for (t = tree.nodes[t].parent; t; t = tree.nodes[t].parent) {
+    covered += nodes[t].add;
+  }
+
+  return covered;
+}
+
+// Adds delta to the folds hiding rows start to end
+static void line_map_cover(int start, int end, int delta) {
+  int a, b, c;
+
+  treap_split(&tree, tree.root, start, &a, &b);
+  treap_split(&tree, b, end - start, &b, &c);
+  line_map_apply(b, delta);
+  treap_set_root(&tree, treap_merge(&tree, treap_merge(&tree, a, b), c));
+}
+
+// Soft wrap toggled or the terminal resized. Only rows wider than limit
+// wrap before or after, the subtrees without one are left alone, and the
+// nodes stay put with their folds.
+static void line_map_reline(int t, int limit) {
+  if (t == 0 || nodes[t].max_width <= limit) {
+    return;
+  }
+
+  line_map_reline(tree.nodes[t].left, limit);
+  line_map_reline(tree.nodes[t].right, limit);
+  nodes[t].lines = line_map_lines(nodes[t].width);
+  line_map_pull(t);
+}
+
+static void line_map_drop_folds(void) {
+  num_folds = 0;
+  num_fold_ids = 0;
+  free_folds = -1;
+}
+
+static void line_map_refresh(void) {
+  int size = treap_size(&tree, tree.root);
+
+  // Rows only ever change through the hooks below, this is a safety net
+  if (size > E.num_rows) {
+    treap_free_tree(&tree, tree.root);
+    treap_set_root(&tree, 0);
+    line_map_drop_folds();
+    size = 0;
+  }
+
+  if (tree_wrap != E.soft_wrap || (E.soft_wrap && tree_cols != E.screen_cols)) {
+    int limit = line_map_limit();
+
+    tree_wrap = E.soft_wrap;
+    tree_cols = E.screen_cols;
+    if (line_map_limit() < limit) {
+      limit = line_map_limit();
+    }
+    line_map_reline(tree.root, limit);
+  }
+
+  // Rows the loader appended come after the last node
+  if (size < E.num_rows) {
+    int added = treap_build(&tree, E.num_rows - size, line_map_fill, &size);
+    treap_set_root(&tree, treap_merge(&tree, tree.root, added));
+  }
+}
+
+// Lines taken up by the rows above row, all of them past the last row
+long line_map_visual(int row) {
+  line_map_refresh();
+
+  if (row >= E.num_rows) {
+    return line_map_shown(tree.root, 0);
+  }
+
+  long lines = 0;
+  int add = 0;
+
+  for (int t = tree.root; t;) {
+    int left = treap_size(&tree, tree.nodes[t].left);
+    int below = add + nodes[t].add;
+
+    if (row < left) {
+      t = tree.nodes[t].left;
+    } else {
+      lines += line_map_shown(tree.nodes[t].left, below);
+      if (row == left) {
+        break;
+      }
+      if (nodes[t].covered + add == 0) {
+        lines += nodes[t].lines;
+      }
+      row -= left + 1;
+      t = tree.nodes[t].right;
+    }
+    add = below;
+  }
+
+  return lines;
+}
+
+// Row shown on the given line, E.num_rows for lines past the last row. sub
+// is set to which of the row's lines it is.
+int line_map_locate(long line, int *sub) {
+  line_map_refresh();
+
+  if (sub) {
+    *sub = 0;
+  }
+  if (line < 0) {
+    line = 0;
+  }
+  if (line >= line_map_shown(tree.root, 0)) {
+    return E.num_rows;
+  }
+
+  int row = 0;
+  int add = 0;
+
+  for (int t = tree.root; t;) {
+    int below = add + nodes[t].add;
+    long left = line_map_shown(tree.nodes[t].left, below);
+
+    if (line < left) {
+      t = tree.nodes[t].left;
+      add = below;
+      continue;
+    }
+
+    line -= left;
+    row += treap_size(&tree, tree.nodes[t].left);
+
+    long own = nodes[t].covered + add == 0 ? nodes[t].lines : 0;
+    if (line < own) {
+      break;
+    }
+
+    line -= own;
+    row++;
+    t = tree.nodes[t].right;
+    add = below;
+  }
+
+  if (sub) {
+    *sub = line;
+  }
+  return row;
+}
+
+int line_map_row_at(long line) { return line_map_locate(line, NULL); }
+
+long line_map_total(void) {
+  line_map_refresh();
+  return line_map_shown(tree.root, 0);
+}
+
+// Shown rows around row, -1 above the first and E.num_rows below the last
+int line_map_prev_row(int row) {
+  long line = line_map_visual(row);
+  return line > 0 ? line_map_row_at(line - 1) : -1;
+}
+
+int line_map_next_row(int row) {
+  if (row >= E.num_rows) {
+    return E.num_rows;
+  }
+
+  return line_map_row_at(line_map_visual(row) + !line_map_hidden(row));
+}
+
+int line_map_hidden(int row) {
+  line_map_refresh();
+
+  if (row >= E.num_rows) {
+    return 0;
+  }
+
+  return line_map_covered(treap_node_at(&tree, row)) > 0;
+}
+
+// Folds
+
+static void line_map_link_first(int fold, int t) {
+  folds[fold].first = t;
+  folds[fold].next_first = nodes[t].first_of;
+  nodes[t].first_of = fold;
+}
+
+static void line_map_link_last(int fold, int t) {
+  folds[fold].last = t;
+  folds[fold].next_last = nodes[t].last_of;
+  nodes[t].last_of = fold;
+}
+
+static void line_map_unlink_first(int fold) {
+  int *p = &nodes[folds[fold].first].first_of;
+  while (*p != fold) {
+    p = &folds[*p].next_first;
+  }
+  *p = folds[fold].next_first;
+}
+
+static void line_map_unlink_last(int fold) {
+  int *p = &nodes[folds[fold].last].last_of;
+  while (*p != fold) {
+    p = &folds[*p].next_last;
+  }
+  *p = folds[fold].next_last;
+}
+
+static int line_map_fold_start(int i) {
+  return treap_position(&tree, folds[order[i]].first);
+}
+
+static int line_map_fold_end(int i) {
+  return treap_position(&tree, folds[order[i]].last) + 1;
+}
+
+// Index of the first fold starting at or after start
+static int line_map_fold_find(int start) {
+  int lo = 0;
+  int hi = num_folds;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (line_map_fold_start(mid) < start) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+// Rows hidden under row as a header, 0 if it isn't one
+int line_map_folded_at(int row) {
+  int i = line_map_fold_find(row + 1);
+  if (i < num_folds && line_map_fold_start(i) == row + 1) {
+    return line_map_fold_end(i) - (row + 1);
+  }
+
+  return 0;
+}
+
+static void line_map_add_fold(int start, int end) {
+  line_map_refresh();
+
+  int i = line_map_fold_find(start);
+  while (i < num_folds && line_map_fold_start(i) == start &&
+         line_map_fold_end(i) > end) {
+    i++;
+  }
+
+  if (num_folds == cap_order) {
+    cap_order = cap_order ? cap_order * 2 : 16;
+    order = mem_realloc(MEM_ROW_INDEX, order, sizeof(int) * cap_order);
+  }
+
+  int fold = free_folds;
+  if (fold >= 0) {
+    free_folds = folds[fold].next_first;
+  } else {
+    if (num_fold_ids == cap_fold_ids) {
+      cap_fold_ids = cap_fold_ids ? cap_fold_ids * 2 : 16;
+      folds = mem_realloc(MEM_ROW_INDEX, folds,
+                          sizeof(struct Fold) * cap_fold_ids);
+    }
+    fold = num_fold_ids++;
+  }
+
+  folds[fold].lost = 0;
+  line_map_link_first(fold, treap_node_at(&tree, start));
+  line_map_link_last(fold, treap_node_at(&tree, end - 1));
+
+  memmove(&order[i + 1], &order[i], sizeof(int) * (num_folds - i));
+  order[i] = fold;
+  num_folds++;
+
+  line_map_cover(start, end, 1);
+  dirty_add(&E.dirty_since_frame, start - 1, INT_MAX);
+}
+
+// Takes fold i out of the order, its nodes already unlinked
+static void line_map_forget_fold(int i) {
+  int fold = order[i];
+
+  memmove(&order[i], &order[i + 1], sizeof(int) * (num_folds - i - 1));
+  num_folds--;
+
+  folds[fold].next_first = free_folds;
+  free_folds = fold;
+}
+
+static void line_map_remove_fold(int i) {
+  line_map_refresh();
+
+  int start = line_map_fold_start(i);
+  line_map_cover(start, line_map_fold_end(i), -1);
+  dirty_add(&E.dirty_since_frame, start - 1, INT_MAX);
+
+  line_map_unlink_first(order[i]);
+  line_map_unlink_last(order[i]);
+  line_map_forget_fold(i);
+}
+
+// Opens every fold hiding row
+void line_map_reveal(int row) {
+  if (!line_map_hidden(row)) {
+    return;
+  }
+
+  for (int i = line_map_fold_find(row + 1) - 1; i >= 0; i--) {
+    if (line_map_fold_start(i) <= row && row < line_map_fold_end(i)) {
+      line_map_remove_fold(i);
+    }
+  }
+}
+
+// An edit changes the row's width, and may break a wrapped row into a
+// different number of lines, which moves every line below it
+void line_map_row_changed(int row) {
+  if (row >= treap_size(&tree, tree.root)) {
+    return;
+  }
+
+  int t = treap_node_at(&tree, row);
+  int width = E.row[row].r_size;
+  if (nodes[t].width == width) {
+    return;
+  }
+
+  int lines = nodes[t].lines;
+  nodes[t].width = width;
+  nodes[t].lines = line_map_lines(width);
+  treap_pull_up(&tree, t);
+
+  if (nodes[t].lines != lines) {
+    dirty_add(&E.dirty_since_frame, row, INT_MAX);
+  }
+}
+
+// New rows are hidden by the folds hiding both rows around them. A row
+// inserted right below a header goes above the rows it hides.
+void line_map_rows_inserted(int at, int count) {
+  if (at > treap_size(&tree, tree.root)) {
+    return;
+  }
+
+  int covered = 0;
+  if (at > 0) {
+    int above = treap_node_at(&tree, at - 1);
+    covered = line_map_covered(above);
+    for (int f = nodes[above].last_of; f >= 0; f = folds[f].next_last) {
+      covered--;
+    }
+  }
+
+  int a, b;
+  int empty = -1;
+  int added = treap_build(&tree, count, line_map_fill, &empty);
+  line_map_apply(added, covered);
+
+  treap_split(&tree, tree.root, at, &a, &b);
+  treap_set_root(&tree, treap_merge(&tree, treap_merge(&tree, a, added), b));
+}
+
+// What a deletion does to a fold
+enum {
+  FOLD_LOST_FIRST = 1,
+  FOLD_LOST_HEADER = 2,
+  FOLD_LOST_LAST = 4,
+};
+
+// Folds a deletion changes, each once
+static int *lost = NULL;
+static int num_lost = 0;
+static int cap_lost = 0;
+
+static void line_map_lose(int fold, int flag) {
+  if (folds[fold].lost == 0) {
+    if (num_lost == cap_lost) {
+      cap_lost = cap_lost ? cap_lost * 2 : 16;
+      lost = mem_realloc(MEM_ROW_INDEX, lost, sizeof(int) * cap_lost);
+    }
+    lost[num_lost++] = fold;
+  }
+
+  folds[fold].lost |= flag;
+}
+
+// Notes the folds held by the nodes of subtree t, its rows from first on
+// about to be deleted from at on
+static void line_map_lose_rows(int t, int first, int at) {
+  if (t == 0) {
+    return;
+  }
+
+  int row = first + treap_size(&tree, tree.nodes[t].left);
+  line_map_lose_rows(tree.nodes[t].left, first, at);
+  line_map_lose_rows(tree.nodes[t].right, row + 1, at);
+
+  // Past the first deleted row the header above goes too
+  for (int f = nodes[t].first_of; f >= 0; f = folds[f].next_first) {
+    line_map_lose(f, row > at ? FOLD_LOST_HEADER : FOLD_LOST_FIRST);
+  }
+  for (int f = nodes[t].last_of; f >= 0; f = folds[f].next_last) {
+    line_map_lose(f, FOLD_LOST_LAST);
+  }
+}
+
+// Folds lose the deleted rows, and go away with their header. Only the
+// folds held by the deleted rows and the row moving up into the gap change.
+void line_map_rows_deleted(int at, int count) {
+  int size = treap_size(&tree, tree.root);
+  if (at >= size) {
+    return;
+  }
+  if (count > size - at) {
+    count = size - at;
+  }
+
+  int a, gone, b;
+  treap_split(&tree, tree.root, at, &a, &b);
+  treap_split(&tree, b, count, &gone, &b);
+  line_map_lose_rows(gone, at, at);
+  treap_free_tree(&tree, gone);
+  treap_set_root(&tree, treap_merge(&tree, a, b));
+
+  // The row moving up into the gap was right below a deleted row
+  int after = treap_node_at(&tree, at);
+  int before = at > 0 ? treap_node_at(&tree, at - 1) : 0;
+  for (int f = after ? nodes[after].first_of : -1; f >= 0;
+       f = folds[f].next_first) {
+    line_map_lose(f, FOLD_LOST_HEADER);
+  }
+
+  for (int i = 0; i < num_lost; i++) {
+    int f = lost[i];
+    int flags = folds[f].lost;
+    int lost_first = flags & (FOLD_LOST_FIRST | FOLD_LOST_HEADER);
+    int first = lost_first ? after : folds[f].first;
+    int last = flags & FOLD_LOST_LAST ? before : folds[f].last;
+    int kept = first && last &&
+               treap_position(&tree, first) <= treap_position(&tree, last);
+
+    folds[f].lost = 0;
+    if (kept && !(flags & FOLD_LOST_HEADER)) {
+      if (flags & FOLD_LOST_FIRST) {
+        line_map_link_first(f, first);
+      }
+      if (flags & FOLD_LOST_LAST) {
+        line_map_link_last(f, last);
+      }
+      continue;
+    }
+
+    // The rows it hid that are left show again
+    if (kept) {
+      line_map_cover(treap_position(&tree, first),
+                     treap_position(&tree, last) + 1, -1);
+    }
+
+    // Only its nodes still in the tree need to let go of it
+    if (!lost_first || folds[f].first == after) {
+      line_map_unlink_first(f);
+    }
+    if (!(flags & FOLD_LOST_LAST)) {
+      line_map_unlink_last(f);
+    }
+
+    int j = 0;
+    while (order[j] != f) {
+      j++;
+    }
+    line_map_forget_fold(j);
+  }
+
+  num_lost = 0;
+}
+
+// What Ctrl-K folds
+
+// Leading blanks of a row, -1 for a blank row
+static int line_map_indent(EditorRow *row) {
+  for (int i = 0; i < row->r_size; i++) {
+    if (row->r_chars[i] != ' ') {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static int line_map_starts_comment(EditorRow *row) {
+  highlight_ensure(row->idx);
+
+  int indent = line_map_indent(row);
+  return indent >= 0 && row->hl[indent] == HL_COMMENT;
+}
+
+// End of the rows a fold under row hides: up to the row closing the block
+// it opens, the rest of a comment, or the rows indented further than it
+static int line_map_region_end(int row) {
+  int close = brackets_block_end(row);
+  if (close > row + 1) {
+    return close;
+  }
+
+  // The row the comment closes on stays visible like a closing bracket
+  int end = row + 1;
+  if (E.row[row].hl_open_comment) {
+    while (end < E.num_rows && E.row[end].hl_open_comment) {
+      end++;
+    }
+    return end;
+  }
+
+  if (line_map_starts_comment(&E.row[row])) {
+    while (end < E.num_rows && line_map_starts_comment(&E.row[end])) {
+      end++;
+    }
+    return end;
+  }
+
+  int indent = line_map_indent(&E.row[row]);
+  if (indent == -1) {
+    return row + 1;
+  }
+
+  // Blank rows only belong to the region if indented rows follow them
+  int last = row + 1;
+  for (; end < E.num_rows; end++) {
+    int inner = line_map_indent(&E.row[end]);
+    if (inner == -1) {
+      continue;
+    }
+    if (inner <= indent) {
+      break;
+    }
+    last = end + 1;
+  }
+
+  return last;
+}
+
+void editor_toggle_fold(void) {
+  int row = E.cursor_y;
+  if (row >= E.num_rows) {
+    return;
+  }
+
+  int i = line_map_fold_find(row + 1);
+  if (i < num_folds && line_map_fold_start(i) == row + 1) {
+    while (i < num_folds && line_map_fold_start(i) == row + 1) {
+      line_map_remove_fold(i);
+    }
+    return;
+  }
+
+  int end = line_map_region_end(row);
+  if (end <= row + 1) {
+    editor_set_status_message("Nothing to fold");
+    return;
+  }
+
+  line_map_add_fold(row + 1, end);
+}
@@ -0,0 +1,27 @@
+#ifndef LINE_MAP_H
+#define LINE_MAP_H
+
+// Maps rows to the lines they take up on screen. Folded rows take none,
+// every other row one or as many as soft wrap breaks it into, and the
+// mapping goes both ways in O(log n).
+
+int line_map_row_lines(int row);
+long line_map_visual(int row);
+int line_map_locate(long line, int *sub);
+int line_map_row_at(long line);
+long line_map_total(void);
+
+int line_map_prev_row(int row);
+int line_map_next_row(int row);
+
+int line_map_hidden(int row);
+int line_map_folded_at(int row);
+void line_map_reveal(int row);
+
+void line_map_row_changed(int row);
+void line_map_rows_inserted(int at, int count);
+void line_map_rows_deleted(int at, int count);
+
+void editor_toggle_fold(void);
+
+#endif // LINE_MAP_H
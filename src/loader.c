@@ -0,0 +1,546 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "brackets.h"
+#include "editor-io.h"
+#include "editor.h"
+#include "gzip.h"
+#include "loader.h"
+#include "memory.h"
+#include "pool.h"
+#include "row-operations.h"
+
+extern struct EditorConfig E;
+
+// The first piece is split before the first frame, so it only needs to fill
+// a screen. The rest are split on worker threads while the editor runs.
+#define LOADER_FIRST_PIECE (1 << 16)
+#define LOADER_PIECE (1 << 22)
+
+#define LOADER_BLOCK 16
+
+struct LoaderChunk {
+  const char *start;
+  const char *end;
+  off_t offset;
+
+  // The inflated text of a compressed file's piece, and how much of the file
+  // was read up to the end of the piece. more is set if the stream goes on
+  // after it, corrupt if it broke off in it.
+  char *text;
+  size_t consumed;
+  int more;
+  int corrupt;
+
+  // Lines end in "\r\n" rather than "\n"
+  int crlf;
+  int lex;
+
+  // Set if saving the rows wouldn't give back the same bytes, if the last
+  // row has no newline and if there are NUL bytes
+  int lossy;
+  int unterminated;
+  int binary;
+  int finished;
+
+  EditorRow *rows;
+  int num_rows;
+  int cap_rows;
+};
+
+// The file being loaded, mapped or read whole, and its pieces. Pieces reach
+// E in file order, whichever order they finish in.
+static char *data = NULL;
+static size_t data_size = 0;
+static int data_mapped = 0;
+
+static struct LoaderChunk **pieces = NULL;
+static int num_pieces = 0;
+static int cap_pieces = 0;
+static int next_piece = 0;
+static size_t loaded_bytes = 0;
+
+static int loading = 0;
+static int lossless = 0;
+static int lex_pieces = 0;
+static int crlf_pieces = 0;
+static LoaderRowsFn rows_loaded = NULL;
+
+// A compressed file is inflated one piece at a time, each cut after its
+// last newline. The start of the line it stopped in goes to the next one.
+static struct GzipReader *reader = NULL;
+static int inflating = 0;
+static int corrupt = 0;
+static char *carry = NULL;
+static size_t carry_len = 0;
+
+// Bit i of the result is set if p[i] is a newline, bit i of nuls if it is a
+// NUL. Bytes past len are ignored.
+static unsigned loader_scan_block(const char *p, size_t len, unsigned *nuls) {
+  char block[LOADER_BLOCK];
+  if (len < LOADER_BLOCK) {
+    memset(block, ' ', LOADER_BLOCK);
+    memcpy(block, p, len);
+    p = block;
+  }
+
+#ifdef __SSE2__
+  __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+  *nuls = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+#else
+  unsigned mask = 0;
+  *nuls = 0;
+
+  for (int i = 0; i < LOADER_BLOCK; i++) {
+    if (p[i] == '\n') {
+      mask |= 1u << i;
+    }
+    if (p[i] == '\0') {
+      *nuls |= 1u << i;
+    }
+  }
+
+  return mask;
+#endif
+}
+
+// Adds the line from start to end, where its newline is unless it is the
+// unterminated last one, and lexes it if the chunk is lexed
+static void loader_add_row(struct LoaderChunk *chunk, const char *start,
+                           const char *end, int terminated,
+                           int *in_comment) {
+  size_t len = end - start;
+
+  // Only the file's own line ending is taken off, so a stray "\r" in a file
+  // of "\n" lines stays in its row and is saved back
+  if (!terminated) {
+    chunk->lossy = 1;
+  } else if (chunk->crlf) {
+    if (len > 0 && start[len - 1] == '\r') {
+      len--;
+    } else {
+      chunk->lossy = 1;
+    }
+  }
+
+  if (chunk->num_rows == chunk->cap_rows) {
+    chunk->cap_rows = chunk->cap_rows ? chunk->cap_rows * 2 : 1024;
+    chunk->rows = mem_realloc(MEM_ROW_INDEX, chunk->rows,
+                              sizeof(EditorRow) * chunk->cap_rows);
+  }
+
+  EditorRow *row = &chunk->rows[chunk->num_rows++];
+  *row = (EditorRow){
+      .size = len,
+      .disk_offset = chunk->offset + (start - chunk->start),
+  };
+
+  row->chars = mem_malloc(MEM_ROW_TEXT, len + 1);
+  memcpy(row->chars, start, len);
+  row->chars[len] = '\0';
+  editor_update_render(row);
+
+  if (chunk->lex) {
+    *in_comment = editor_highlight_row(row, *in_comment);
+    row->hl_open_comment = *in_comment;
+    brackets_collect_row(row);
+  }
+}
+
+// Splits the chunk into rows and renders them, and lexes them as if the
+// chunk started outside a comment if asked to. Newlines are found a block
+// at a time. Runs on a worker thread, so it only touches the chunk and
+// E.syntax, which can't change while saving is refused.
+static void loader_split_chunk(struct Task *task, void *arg) {
+  (void)task;
+
+  struct LoaderChunk *chunk = arg;
+  const char *line = chunk->start;
+  int in_comment = 0;
+
+  for (const char *p = chunk->start; p < chunk->end; p += LOADER_BLOCK) {
+    unsigned nuls;
+    unsigned mask = loader_scan_block(p, chunk->end - p, &nuls);
+    chunk->binary |= nuls != 0;
+
+    while (mask) {
+      const char *newline = p + __builtin_ctz(mask);
+      mask &= mask - 1;
+
+      loader_add_row(chunk, line, newline, 1, &in_comment);
+      line = newline + 1;
+    }
+  }
+
+  if (line < chunk->end) {
+    loader_add_row(chunk, line, chunk->end, 0, &in_comment);
+    chunk->unterminated = 1;
+  }
+}
+
+// Whether the first line of data ends in "\r\n", which is then taken to be
+// how the file ends all of them
+static int loader_detect_crlf(const char *data, size_t size) {
+  const char *newline = memchr(data, '\n', size);
+  return newline && newline > data && newline[-1] == '\r';
+}
+
+// Reads files that can't be mapped (pipes, character devices) into memory
+static char *loader_read_all(int fd, size_t *size) {
+  size_t cap = 1 << 16;
+  size_t len = 0;
+  char *buf = mem_malloc(MEM_FILE_IO, cap);
+
+  while (1) {
+    if (len == cap) {
+      cap *= 2;
+      buf = mem_realloc(MEM_FILE_IO, buf, cap);
+    }
+
+    ssize_t nread = read(fd, &buf[len], cap - len);
+    if (nread == 0) {
+      break;
+    }
+    if (nread == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      mem_free(buf);
+      return NULL;
+    }
+
+    len += nread;
+  }
+
+  *size = len;
+  return buf;
+}
+
+static struct LoaderChunk *loader_add_piece(void) {
+  if (num_pieces == cap_pieces) {
+    cap_pieces = cap_pieces ? cap_pieces * 2 : 16;
+    pieces = mem_realloc(MEM_FILE_IO, pieces,
+                         sizeof(struct LoaderChunk *) * cap_pieces);
+  }
+
+  struct LoaderChunk *piece = mem_malloc(MEM_FILE_IO, sizeof(*piece));
+  *piece = (struct LoaderChunk){.crlf = crlf_pieces, .lex = lex_pieces};
+
+  pieces[num_pieces++] = piece;
+  return piece;
+}
+
+// Cuts the data into pieces right after a newline, so no line spans two of
+// them
+static void loader_cut_pieces(void) {
+  const char *end = data + data_size;
+  const char *p = data;
+
+  while (p < end) {
+    size_t size = num_pieces == 0 ? LOADER_FIRST_PIECE : LOADER_PIECE;
+    const char *chunk_end = end;
+
+    if ((size_t)(end - p) > size) {
+      const char *newline = memchr(p + size, '\n', end - p - size);
+      chunk_end = newline ? newline + 1 : end;
+    }
+
+    struct LoaderChunk *piece = loader_add_piece();
+    piece->start = p;
+    piece->end = chunk_end;
+    piece->offset = p - data;
+    piece->consumed = chunk_end - data;
+    p = chunk_end;
+  }
+}
+
+// Inflates at least limit bytes into the piece, more if that is what it
+// takes to reach a newline. Runs on a worker thread, one piece after the
+// other, so it has the stream and the carried line to itself.
+static void loader_inflate(struct LoaderChunk *piece, size_t limit) {
+  size_t cap = carry_len + limit;
+  char *text = mem_malloc(MEM_FILE_IO, cap);
+  size_t len = carry_len;
+  if (carry_len > 0) {
+    memcpy(text, carry, carry_len);
+  }
+
+  const char *last_newline = memrchr(text, '\n', len);
+  int status = 1;
+
+  while (status == 1 && (len < limit || last_newline == NULL)) {
+    if (len == cap) {
+      cap *= 2;
+      text = mem_realloc(MEM_FILE_IO, text, cap);
+      last_newline = memrchr(text, '\n', len);
+    }
+
+    size_t n;
+    status = gzip_inflate(reader, &text[len], cap - len, &n);
+
+    const char *newline = memrchr(&text[len], '\n', n);
+    if (newline) {
+      last_newline = newline;
+    }
+    len += n;
+  }
+
+  // The whole file is in once the stream ends
+  size_t cut = status == 1 ? (size_t)(last_newline + 1 - text) : len;
+  carry_len = len - cut;
+  carry = mem_realloc(MEM_FILE_IO, carry, carry_len ? carry_len : 1);
+  memcpy(carry, &text[cut], carry_len);
+
+  piece->text = text;
+  piece->start = text;
+  piece->end = text + cut;
+  piece->consumed = gzip_consumed(reader);
+  piece->lossy = 1;
+  piece->more = status == 1;
+  piece->corrupt = status == -1;
+}
+
+static void loader_inflate_task(struct Task *task, void *arg) {
+  (void)task;
+  loader_inflate(arg, LOADER_PIECE);
+}
+
+static void loader_finish(void) {
+  if (data_mapped) {
+    munmap(data, data_size);
+  } else {
+    mem_free(data);
+  }
+  data = NULL;
+
+  mem_free(pieces);
+  pieces = NULL;
+  num_pieces = 0;
+  cap_pieces = 0;
+
+  gzip_reader_close(reader);
+  reader = NULL;
+  mem_free(carry);
+  carry = NULL;
+  carry_len = 0;
+
+  E.disk_known &= lossless;
+  loading = 0;
+
+  if (corrupt) {
+    E.truncated = 1;
+    editor_set_status_message(
+        "Compressed data is corrupt after line %d, the rest is missing",
+        E.num_rows);
+  }
+}
+
+// Appends the finished pieces that come next in the file to E
+static void loader_merge(void) {
+  int first = E.num_rows;
+  int total = 0;
+
+  int last = next_piece;
+  while (last < num_pieces && pieces[last]->finished) {
+    total += pieces[last]->num_rows;
+    last++;
+  }
+  if (last == next_piece) {
+    return;
+  }
+
+  E.row = mem_realloc(MEM_ROW_INDEX, E.row,
+                      sizeof(EditorRow) * (E.num_rows + total));
+
+  for (; next_piece < last; next_piece++) {
+    struct LoaderChunk *piece = pieces[next_piece];
+
+    if (piece->num_rows > 0) {
+      memcpy(&E.row[E.num_rows], piece->rows,
+             sizeof(EditorRow) * piece->num_rows);
+      E.num_rows += piece->num_rows;
+    }
+
+    lossless &= !piece->lossy;
+    loaded_bytes = piece->consumed;
+
+    if (piece->unterminated) {
+      E.final_newline = 0;
+    }
+
+    // A NUL early on marks the file binary, the way git and grep tell. Later
+    // pieces can't, the rows before them may already be edited.
+    if (next_piece == 0) {
+      E.binary = piece->binary;
+    }
+
+    mem_free(piece->rows);
+    mem_free(piece->text);
+    mem_free(piece);
+  }
+
+  for (int i = first; i < E.num_rows; i++) {
+    E.row[i].idx = i;
+  }
+
+  int finished = next_piece == num_pieces && !inflating;
+  if (finished) {
+    loader_finish();
+  }
+
+  rows_loaded(first, E.num_rows - first, finished);
+}
+
+static void loader_piece_done(void *arg, int cancelled) {
+  (void)cancelled;
+
+  struct LoaderChunk *piece = arg;
+  piece->finished = 1;
+
+  loader_merge();
+}
+
+// A piece was inflated: the stream goes on with the next one while this one
+// is split
+static void loader_inflate_done(void *arg, int cancelled) {
+  (void)cancelled;
+
+  struct LoaderChunk *piece = arg;
+  inflating = piece->more;
+  corrupt = piece->corrupt;
+
+  if (inflating) {
+    pool_submit(TASK_HIGH, loader_inflate_task, loader_inflate_done,
+                loader_add_piece());
+  }
+
+  pool_submit(TASK_HIGH, loader_split_chunk, loader_piece_done, arg);
+}
+
+// Inflates the first piece of a file that starts like gzip. Returns 0 if
+// not even the start of it inflates, the file is then loaded as it is.
+static int loader_start_gzip(void) {
+  reader = gzip_reader_open(data, data_size);
+  if (reader == NULL) {
+    return 0;
+  }
+
+  struct LoaderChunk *first = loader_add_piece();
+  loader_inflate(first, LOADER_FIRST_PIECE);
+
+  if (first->corrupt && first->end == first->start) {
+    mem_free(first->text);
+    mem_free(first);
+    num_pieces = 0;
+
+    gzip_reader_close(reader);
+    reader = NULL;
+    return 0;
+  }
+
+  inflating = first->more;
+  corrupt = first->corrupt;
+  return 1;
+}
+
+int editor_load_rows(int fd, int lex, LoaderRowsFn loaded) {
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return -1;
+  }
+
+  // Saves may only write in place into a regular file that was read whole
+  E.disk_known = S_ISREG(st.st_mode) && E.num_rows == 0;
+  E.disk_size = st.st_size;
+  E.disk_mtime = st.st_mtim.tv_sec;
+  E.disk_mtime_nsec = st.st_mtim.tv_nsec;
+
+  data = MAP_FAILED;
+  data_mapped = 0;
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+
+  if (data != MAP_FAILED) {
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    data_size = st.st_size;
+    data_mapped = 1;
+  } else {
+    data = loader_read_all(fd, &data_size);
+    if (data == NULL) {
+      return -1;
+    }
+  }
+
+  lossless = (off_t)data_size == st.st_size;
+  loaded_bytes = 0;
+  next_piece = 0;
+  lex_pieces = lex;
+  rows_loaded = loaded;
+  loading = 1;
+  inflating = 0;
+  corrupt = 0;
+  E.final_newline = 1;
+  E.truncated = 0;
+
+  if (gzip_detect(data, data_size) && loader_start_gzip()) {
+    // Rows don't map back to bytes of the file, saves write it whole
+    E.disk_gzip = 1;
+    E.disk_known = 0;
+
+    struct LoaderChunk *first = pieces[0];
+    crlf_pieces = loader_detect_crlf(first->start, first->end - first->start);
+    first->crlf = crlf_pieces;
+    E.crlf = crlf_pieces;
+
+    if (inflating) {
+      pool_submit(TASK_HIGH, loader_inflate_task, loader_inflate_done,
+                  loader_add_piece());
+    }
+  } else {
+    E.disk_gzip = 0;
+
+    crlf_pieces = loader_detect_crlf(data, data_size);
+    E.crlf = crlf_pieces;
+    loader_cut_pieces();
+    if (num_pieces == 0) {
+      loader_finish();
+      rows_loaded(E.num_rows, 0, 1);
+      return 0;
+    }
+
+    // Workers take their newest task first, so submitting from the end gets
+    // the pieces near the top of the file to the screen first
+    for (int i = num_pieces - 1; i > 0; i--) {
+      pool_submit(TASK_HIGH, loader_split_chunk, loader_piece_done,
+                  pieces[i]);
+    }
+  }
+
+  loader_split_chunk(NULL, pieces[0]);
+  pieces[0]->finished = 1;
+  loader_merge();
+
+  return 0;
+}
+
+int loader_active(void) { return loading; }
+
+// How much of the file being loaded is in E, in percent
+int loader_progress(void) {
+  return data_size ? (int)(loaded_bytes * 100 / data_size) : 100;
+}
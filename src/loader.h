@@ -0,0 +1,17 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+// Called on the main thread each time rows of the file reach E, in file
+// order. finished is set with the last of them.
+typedef void (*LoaderRowsFn)(int first, int count, int finished);
+
+// Appends the rows of an open file to E. The first screenful is there when
+// it returns, the rest is split on worker threads and arrives from
+// pool_drain. fd may be closed right away. With lex set, each piece of the
+// file is lexed as if it started outside a comment.
+int editor_load_rows(int fd, int lex, LoaderRowsFn loaded);
+
+int loader_active(void);
+int loader_progress(void);
+
+#endif // LOADER_H
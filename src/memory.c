@@ -0,0 +1,144 @@
+#include <stdlib.h>
+
+#include "memory.h"
+
+// Header stored in front of every tagged block, 16 bytes keep the payload
+// aligned like plain malloc
+struct memHeader {
+  size_t size;
+  size_t tag;
+};
+
+struct memCounter {
+  size_t live;
+  size_t peak;
+};
+
+static struct memCounter counters[MEM_TAG_COUNT];
+static struct memCounter total;
+
+static const char *tag_names[MEM_TAG_COUNT] = {
+    [MEM_ROW_INDEX] = "idx",   [MEM_ROW_TEXT] = "txt", [MEM_RENDER] = "rnd",
+    [MEM_HIGHLIGHT] = "hl",    [MEM_FRAME] = "ab",     [MEM_SEARCH] = "find",
+    [MEM_FILE_IO] = "io",      [MEM_WORD_INDEX] = "words",
+    [MEM_CLIPBOARD] = "clip",
+};
+
+static const char *report_path = NULL;
+
+// Loader threads allocate rows concurrently
+static void mem_account(struct memCounter *c, size_t added, size_t removed) {
+  size_t live =
+      __atomic_add_fetch(&c->live, added - removed, __ATOMIC_RELAXED);
+
+  size_t peak = __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+  while (live > peak &&
+         !__atomic_compare_exchange_n(&c->peak, &peak, live, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static void mem_track(size_t tag, size_t added, size_t removed) {
+  mem_account(&counters[tag], added, removed);
+  mem_account(&total, added, removed);
+}
+
+void *mem_malloc(enum memTag tag, size_t size) {
+  return mem_realloc(tag, NULL, size);
+}
+
+void *mem_realloc(enum memTag tag, void *ptr, size_t size) {
+  struct memHeader *header = NULL;
+  size_t old_size = 0;
+
+  if (ptr != NULL) {
+    header = (struct memHeader *)ptr - 1;
+    old_size = header->size;
+    tag = header->tag;
+  }
+
+  struct memHeader *new_header =
+      realloc(header, sizeof(struct memHeader) + size);
+  if (new_header == NULL) {
+    return NULL;
+  }
+
+  new_header->size = size;
+  new_header->tag = tag;
+  mem_track(tag, size, old_size);
+
+  return new_header + 1;
+}
+
+void mem_free(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+
+  struct memHeader *header = (struct memHeader *)ptr - 1;
+  mem_track(header->tag, 0, header->size);
+
+  free(header);
+}
+
+size_t mem_live(enum memTag tag) { return counters[tag].live; }
+
+size_t mem_peak(enum memTag tag) { return counters[tag].peak; }
+
+// Human readable size in at most 5 characters
+static int mem_format_size(char *buf, int size, size_t bytes) {
+  if (bytes < 1024) {
+    return snprintf(buf, size, "%zu", bytes);
+  }
+  if (bytes < 1024 * 1024) {
+    return snprintf(buf, size, "%.1fK", bytes / 1024.0);
+  }
+  if (bytes < 1024 * 1024 * 1024) {
+    return snprintf(buf, size, "%.1fM", bytes / (1024.0 * 1024));
+  }
+
+  return snprintf(buf, size, "%.1fG", bytes / (1024.0 * 1024 * 1024));
+}
+
+int mem_format_usage(char *buf, int size) {
+  char amount[16];
+  int len = snprintf(buf, size, "mem");
+
+  for (int tag = 0; tag < MEM_TAG_COUNT && len < size; tag++) {
+    mem_format_size(amount, sizeof(amount), counters[tag].live);
+    len += snprintf(&buf[len], size - len, " %s %s", tag_names[tag], amount);
+  }
+
+  if (len < size) {
+    mem_format_size(amount, sizeof(amount), total.peak);
+    len += snprintf(&buf[len], size - len, " | peak %s", amount);
+  }
+
+  return len;
+}
+
+void mem_dump(FILE *fp) {
+  fprintf(fp, "%-6s %14s %14s\n", "tag", "live", "peak");
+
+  for (int tag = 0; tag < MEM_TAG_COUNT; tag++) {
+    fprintf(fp, "%-6s %14zu %14zu\n", tag_names[tag], counters[tag].live,
+            counters[tag].peak);
+  }
+
+  fprintf(fp, "%-6s %14zu %14zu\n", "total", total.live, total.peak);
+}
+
+static void mem_report(void) {
+  FILE *fp = fopen(report_path, "w");
+  if (fp == NULL) {
+    return;
+  }
+
+  mem_dump(fp);
+  fclose(fp);
+}
+
+void mem_report_at_exit(const char *path) {
+  report_path = path;
+  atexit(mem_report);
+}
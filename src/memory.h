@@ -0,0 +1,34 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Every allocation is tagged with the subsystem that owns it
+
+enum memTag {
+  MEM_ROW_INDEX = 0,
+  MEM_ROW_TEXT,
+  MEM_RENDER,
+  MEM_HIGHLIGHT,
+  MEM_FRAME,
+  MEM_SEARCH,
+  MEM_FILE_IO,
+  MEM_WORD_INDEX,
+  MEM_CLIPBOARD,
+
+  MEM_TAG_COUNT,
+};
+
+void *mem_malloc(enum memTag tag, size_t size);
+void *mem_realloc(enum memTag tag, void *ptr, size_t size);
+void mem_free(void *ptr);
+
+size_t mem_live(enum memTag tag);
+size_t mem_peak(enum memTag tag);
+
+int mem_format_usage(char *buf, int size);
+void mem_dump(FILE *fp);
+void mem_report_at_exit(const char *path);
+
+#endif // MEMORY_H
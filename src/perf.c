@@ -0,0 +1,105 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+
+struct FrameStats {
+  uint64_t key_ns;
+  uint64_t frame_start_ns;
+  int rows_rehighlighted;
+
+  // Last completed frame
+  uint64_t key_to_frame_ns;
+  uint64_t build_ns;
+  int bytes_written;
+  int rehighlighted;
+};
+
+static struct FrameStats stats;
+
+static FILE *trace_fp = NULL;
+static uint64_t trace_epoch_ns;
+static int trace_events;
+
+uint64_t perf_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Frame statistics
+
+void perf_key_pressed(void) {
+  if (stats.key_ns == 0) {
+    stats.key_ns = perf_now_ns();
+  }
+}
+
+void perf_frame_begin(void) { stats.frame_start_ns = perf_now_ns(); }
+
+void perf_frame_end(int bytes_written) {
+  uint64_t now = perf_now_ns();
+
+  stats.build_ns = now - stats.frame_start_ns;
+  stats.bytes_written = bytes_written;
+  stats.rehighlighted = stats.rows_rehighlighted;
+  stats.rows_rehighlighted = 0;
+
+  // Frames without a key in between keep showing the last latency
+  if (stats.key_ns) {
+    stats.key_to_frame_ns = now - stats.key_ns;
+    stats.key_ns = 0;
+  }
+}
+
+// Rows can be highlighted on worker threads
+void perf_count_rehighlight(void) {
+  __atomic_add_fetch(&stats.rows_rehighlighted, 1, __ATOMIC_RELAXED);
+}
+
+int perf_hud_format(char *buf, int size) {
+  return snprintf(buf, size, "key %.2fms | build %.2fms | %dB | hl %d",
+                  stats.key_to_frame_ns / 1e6, stats.build_ns / 1e6,
+                  stats.bytes_written, stats.rehighlighted);
+}
+
+// Chrome trace
+
+static void perf_trace_close(void) {
+  fputs("\n]\n", trace_fp);
+  fclose(trace_fp);
+  trace_fp = NULL;
+}
+
+void perf_trace_open(const char *path) {
+  trace_fp = fopen(path, "w");
+  if (trace_fp == NULL) {
+    return;
+  }
+
+  trace_epoch_ns = perf_now_ns();
+  fputs("[\n", trace_fp);
+  atexit(perf_trace_close);
+}
+
+uint64_t perf_trace_begin(void) { return trace_fp ? perf_now_ns() : 0; }
+
+void perf_trace_end(const char *name, uint64_t start_ns) {
+  if (trace_fp == NULL) {
+    return;
+  }
+
+  uint64_t end_ns = perf_now_ns();
+  fprintf(trace_fp,
+          "%s{\"name\":\"%s\",\"cat\":\"kilo\",\"ph\":\"X\",\"ts\":%.3f,"
+          "\"dur\":%.3f,\"pid\":%d,\"tid\":1}",
+          trace_events++ ? ",\n" : "", name,
+          (start_ns - trace_epoch_ns) / 1e3, (end_ns - start_ns) / 1e3,
+          (int)getpid());
+}
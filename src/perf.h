@@ -0,0 +1,22 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+
+uint64_t perf_now_ns(void);
+
+// Frame statistics for the status bar HUD
+
+void perf_key_pressed(void);
+void perf_frame_begin(void);
+void perf_frame_end(int bytes_written);
+void perf_count_rehighlight(void);
+int perf_hud_format(char *buf, int size);
+
+// Chrome trace export, see chrome://tracing or ui.perfetto.dev
+
+void perf_trace_open(const char *path);
+uint64_t perf_trace_begin(void);
+void perf_trace_end(const char *name, uint64_t start_ns);
+
+#endif // PERF_H
@@ -0,0 +1,341 @@
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+#define POOL_MAX_WORKERS 64
+
+// Batch tasks from parallel_run go before any background work
+#define TASK_BATCH (TASK_LOW + 1)
+#define TASK_LEVELS (TASK_BATCH + 1)
+
+struct TaskBatch {
+  void *(*fn)(void *);
+  int remaining;
+
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+};
+
+struct Task {
+  TaskFn run;
+  TaskDoneFn done;
+  void *arg;
+
+  int cancelled;
+  struct TaskBatch *batch;
+
+  // Link in the finished stack
+  struct Task *next;
+};
+
+// The owner pushes and pops at the bottom, thieves take from the top
+struct TaskDeque {
+  pthread_mutex_t lock;
+  struct Task **tasks;
+  size_t cap;
+  size_t top;
+  size_t bottom;
+};
+
+struct Worker {
+  pthread_t thread;
+  int id;
+  struct TaskDeque deques[TASK_LEVELS];
+};
+
+static struct Worker workers[POOL_MAX_WORKERS];
+static int num_workers = 0;
+static int next_worker = 0;
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t sleep_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_available = PTHREAD_COND_INITIALIZER;
+static int pending = 0;
+
+// Lock-free stack of finished background tasks, popped by pool_drain
+static struct Task *finished = NULL;
+
+// Deques
+
+static void deque_push(struct TaskDeque *d, struct Task *task) {
+  pthread_mutex_lock(&d->lock);
+
+  if (d->bottom - d->top == d->cap) {
+    size_t cap = d->cap ? d->cap * 2 : 64;
+    struct Task **tasks = malloc(sizeof(struct Task *) * cap);
+
+    for (size_t i = d->top; i < d->bottom; i++) {
+      tasks[i - d->top] = d->tasks[i % d->cap];
+    }
+
+    free(d->tasks);
+    d->tasks = tasks;
+    d->bottom -= d->top;
+    d->top = 0;
+    d->cap = cap;
+  }
+
+  d->tasks[d->bottom++ % d->cap] = task;
+  pthread_mutex_unlock(&d->lock);
+}
+
+static struct Task *deque_pop(struct TaskDeque *d, int steal) {
+  struct Task *task = NULL;
+  pthread_mutex_lock(&d->lock);
+
+  if (d->bottom != d->top) {
+    if (steal) {
+      task = d->tasks[d->top++ % d->cap];
+    } else {
+      task = d->tasks[--d->bottom % d->cap];
+    }
+  }
+
+  pthread_mutex_unlock(&d->lock);
+  return task;
+}
+
+static const int take_order[] = {TASK_BATCH, TASK_HIGH, TASK_LOW};
+
+// Own deque first, then steal from the others, highest priority first
+static struct Task *pool_take(int self, int batch_only) {
+  int levels = batch_only ? 1 : TASK_LEVELS;
+
+  for (int i = 0; i < levels; i++) {
+    int level = take_order[i];
+
+    if (self >= 0) {
+      struct Task *task = deque_pop(&workers[self].deques[level], 0);
+      if (task) {
+        return task;
+      }
+    }
+
+    int count = __atomic_load_n(&num_workers, __ATOMIC_ACQUIRE);
+    for (int j = 0; j < count; j++) {
+      int victim = (self + 1 + j) % count;
+      if (victim == self) {
+        continue;
+      }
+
+      struct Task *task = deque_pop(&workers[victim].deques[level], 1);
+      if (task) {
+        return task;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+// Running tasks
+
+static void pool_finish(struct Task *task) {
+  if (task->batch) {
+    struct TaskBatch *batch = task->batch;
+    free(task);
+
+    pthread_mutex_lock(&batch->lock);
+    if (--batch->remaining == 0) {
+      pthread_cond_signal(&batch->finished);
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    return;
+  }
+
+  struct Task *head = __atomic_load_n(&finished, __ATOMIC_RELAXED);
+  do {
+    task->next = head;
+  } while (!__atomic_compare_exchange_n(&finished, &head, task, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void pool_execute(struct Task *task) {
+  __atomic_sub_fetch(&pending, 1, __ATOMIC_RELAXED);
+
+  if (!task_cancelled(task)) {
+    task->run(task, task->arg);
+  }
+
+  pool_finish(task);
+}
+
+static void *pool_worker(void *arg) {
+  struct Worker *self = arg;
+
+  while (1) {
+    struct Task *task = pool_take(self->id, 0);
+    if (task) {
+      pool_execute(task);
+      continue;
+    }
+
+    pthread_mutex_lock(&sleep_lock);
+    while (__atomic_load_n(&pending, __ATOMIC_RELAXED) == 0) {
+      pthread_cond_wait(&work_available, &sleep_lock);
+    }
+    pthread_mutex_unlock(&sleep_lock);
+  }
+
+  return NULL;
+}
+
+static void pool_start(void) {
+  // The main thread takes part in parallel_run, so one core is left for it
+  int count = parallel_workers() - 1;
+  if (count < 1) {
+    count = 1;
+  }
+
+  for (int i = 0; i < count; i++) {
+    workers[i].id = i;
+    for (int level = 0; level < TASK_LEVELS; level++) {
+      pthread_mutex_init(&workers[i].deques[level].lock, NULL);
+    }
+  }
+
+  int started = 0;
+  while (started < count && pthread_create(&workers[started].thread, NULL,
+                                           pool_worker,
+                                           &workers[started]) == 0) {
+    started++;
+  }
+
+  // Workers that already run only miss out on stealing until this lands
+  __atomic_store_n(&num_workers, started, __ATOMIC_RELEASE);
+}
+
+static void pool_push(struct Task *task, int level) {
+  pthread_once(&pool_once, pool_start);
+
+  __atomic_add_fetch(&pending, 1, __ATOMIC_RELAXED);
+
+  // Without threads the caller does the work itself
+  if (num_workers == 0) {
+    pool_execute(task);
+    return;
+  }
+
+  int worker = next_worker++ % num_workers;
+  deque_push(&workers[worker].deques[level], task);
+
+  pthread_mutex_lock(&sleep_lock);
+  pthread_cond_signal(&work_available);
+  pthread_mutex_unlock(&sleep_lock);
+}
+
+// Background tasks
+
+struct Task *pool_submit(enum taskPriority priority, TaskFn run,
+                         TaskDoneFn done, void *arg) {
+  struct Task *task = malloc(sizeof(struct Task));
+  *task = (struct Task){.run = run, .done = done, .arg = arg};
+
+  pool_push(task, priority);
+
+  return task;
+}
+
+// The handle stays valid until its done callback has run
+void pool_cancel(struct Task *task) {
+  __atomic_store_n(&task->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+int task_cancelled(struct Task *task) {
+  return __atomic_load_n(&task->cancelled, __ATOMIC_RELAXED);
+}
+
+// Runs the done callbacks of finished tasks in the order the tasks finished.
+// That isn't the order they were submitted in, callers that need one keep
+// it themselves, as the loader does with its pieces.
+int pool_drain(void) {
+  struct Task *task = __atomic_exchange_n(&finished, NULL, __ATOMIC_ACQUIRE);
+
+  struct Task *ordered = NULL;
+  while (task) {
+    struct Task *next = task->next;
+    task->next = ordered;
+    ordered = task;
+    task = next;
+  }
+
+  int count = 0;
+  while (ordered) {
+    struct Task *next = ordered->next;
+
+    if (ordered->done) {
+      ordered->done(ordered->arg, task_cancelled(ordered));
+    }
+
+    free(ordered);
+    ordered = next;
+    count++;
+  }
+
+  return count;
+}
+
+// Fork-join
+
+int parallel_workers(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (cpus < 1) {
+    return 1;
+  }
+  if (cpus > POOL_MAX_WORKERS) {
+    return POOL_MAX_WORKERS;
+  }
+
+  return cpus;
+}
+
+static void batch_run(struct Task *task, void *arg) {
+  task->batch->fn(arg);
+}
+
+void parallel_run(void *(*fn)(void *), void *tasks, size_t task_size,
+                  int count) {
+  char *task_args = tasks;
+
+  if (count <= 1) {
+    if (count == 1) {
+      fn(task_args);
+    }
+    return;
+  }
+
+  struct TaskBatch batch = {.fn = fn, .remaining = count - 1};
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.finished, NULL);
+
+  for (int i = 1; i < count; i++) {
+    struct Task *task = malloc(sizeof(struct Task));
+    *task = (struct Task){
+        .run = batch_run, .arg = &task_args[i * task_size], .batch = &batch};
+
+    pool_push(task, TASK_BATCH);
+  }
+
+  fn(task_args);
+
+  // Help with the batch instead of waiting for busy workers
+  struct Task *task;
+  while ((task = pool_take(-1, 1)) != NULL) {
+    pool_execute(task);
+  }
+
+  pthread_mutex_lock(&batch.lock);
+  while (batch.remaining > 0) {
+    pthread_cond_wait(&batch.finished, &batch.lock);
+  }
+  pthread_mutex_unlock(&batch.lock);
+
+  pthread_mutex_destroy(&batch.lock);
+  pthread_cond_destroy(&batch.finished);
+}
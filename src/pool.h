@@ -0,0 +1,38 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Shared worker threads for background editor work.
+//
+// Background tasks must never read or write E: everything they need is
+// copied into their argument when they are submitted, together with the
+// E.version it was copied at. Their done callback runs on the main thread
+// from pool_drain and drops results whose version no longer matches.
+// parallel_run is the exception: the main thread blocks until all of its
+// tasks return, so they may use the rows they were handed.
+
+enum taskPriority {
+  TASK_HIGH = 0,
+  TASK_LOW,
+};
+
+struct Task;
+
+typedef void (*TaskFn)(struct Task *task, void *arg);
+typedef void (*TaskDoneFn)(void *arg, int cancelled);
+
+struct Task *pool_submit(enum taskPriority priority, TaskFn run,
+                         TaskDoneFn done, void *arg);
+void pool_cancel(struct Task *task);
+int task_cancelled(struct Task *task);
+int pool_drain(void);
+
+int parallel_workers(void);
+
+// Calls fn once per element of the tasks array and waits for all of them,
+// the calling thread runs the first task and helps with the rest
+void parallel_run(void *(*fn)(void *), void *tasks, size_t task_size,
+                  int count);
+
+#endif // POOL_H
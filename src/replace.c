@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "editor-io.h"
+#include "editor-operations.h"
+#include "editor.h"
+#include "loader.h"
+#include "memory.h"
+#include "replace.h"
+#include "row-operations.h"
+
+extern struct EditorConfig E;
+
+// Turns \n, \t and \\ into the bytes the prompt can't take. Returns the
+// new length.
+static size_t replace_unescape(char *s) {
+  size_t out = 0;
+
+  for (size_t i = 0; s[i]; i++) {
+    if (s[i] == '\\' && s[i + 1]) {
+      char c = s[++i];
+      s[out++] = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+    } else {
+      s[out++] = s[i];
+    }
+  }
+
+  s[out] = '\0';
+  return out;
+}
+
+// Occurrences of query in a row, none overlapping
+static int replace_count_row(EditorRow *row, const char *query, size_t len) {
+  const char *p = row->chars;
+  const char *end = row->chars + row->size;
+  int count = 0;
+
+  while ((p = memmem(p, end - p, query, len)) != NULL) {
+    count++;
+    p += len;
+  }
+
+  return count;
+}
+
+// Every row with a match gets its new text built in one go, then they are
+// all handed over together. Returns how many occurrences were replaced.
+long replace_all(const char *query, size_t len, const char *with,
+                 size_t with_len) {
+  struct RowEdit *edits = NULL;
+  int num_edits = 0;
+  int cap_edits = 0;
+  long replaced = 0;
+
+  if (len == 0) {
+    return 0;
+  }
+
+  for (int i = 0; i < E.num_rows; i++) {
+    EditorRow *row = &E.row[i];
+    int count = replace_count_row(row, query, len);
+    if (count == 0) {
+      continue;
+    }
+
+    size_t new_len = row->size + count * with_len - count * len;
+    char *text = mem_malloc(MEM_ROW_TEXT, new_len + 1);
+
+    const char *from = row->chars;
+    const char *end = row->chars + row->size;
+    char *to = text;
+    const char *match;
+    while ((match = memmem(from, end - from, query, len)) != NULL) {
+      memcpy(to, from, match - from);
+      to += match - from;
+      memcpy(to, with, with_len);
+      to += with_len;
+      from = match + len;
+    }
+    memcpy(to, from, end - from);
+
+    if (num_edits == cap_edits) {
+      cap_edits = cap_edits ? cap_edits * 2 : 64;
+      edits = mem_realloc(MEM_ROW_INDEX, edits,
+                          sizeof(struct RowEdit) * cap_edits);
+    }
+    edits[num_edits++] = (struct RowEdit){
+        .row = i,
+        .text = text,
+        .len = new_len,
+    };
+    replaced += count;
+  }
+
+  editor_rows_rewrite(edits, num_edits);
+  mem_free(edits);
+
+  return replaced;
+}
+
+void editor_replace(void) {
+  if (editor_read_only()) {
+    return;
+  }
+  if (loader_active()) {
+    editor_set_status_message("Can't replace while the file is still loading");
+    return;
+  }
+
+  char *query = editor_prompt("Replace: %s (\\t for a tab, ESC to cancel)",
+                              NULL);
+  if (query == NULL) {
+    return;
+  }
+
+  char *with =
+      editor_prompt("Replace with: %s (\\n for a new line, ESC to cancel)",
+                    NULL);
+  if (with == NULL) {
+    free(query);
+    return;
+  }
+
+  // Both sides take the same escapes. A query with \n finds nothing, as no
+  // row holds a newline.
+  size_t len = replace_unescape(query);
+  long replaced = replace_all(query, len, with, replace_unescape(with));
+
+  // The text under the cursor may have got shorter or moved down
+  if (E.cursor_y < E.num_rows && E.cursor_x > E.row[E.cursor_y].size) {
+    E.cursor_x = E.row[E.cursor_y].size;
+  }
+
+  editor_set_status_message("Replaced %ld occurrence%s", replaced,
+                            replaced == 1 ? "" : "s");
+
+  free(query);
+  free(with);
+}
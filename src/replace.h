@@ -0,0 +1,13 @@
+#ifndef REPLACE_H
+#define REPLACE_H
+
+#include <stddef.h>
+
+// Replaces every occurrence of a string at once, rewriting each row it
+// touches a single time
+
+long replace_all(const char *query, size_t len, const char *with,
+                 size_t with_len);
+void editor_replace(void);
+
+#endif // REPLACE_H
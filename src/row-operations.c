@@ -1,9 +1,22 @@
 #include <ctype.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "brackets.h"
+#include "clipboard.h"
+#include "completion.h"
+#include "dirty.h"
 #include "editor.h"
+#include "highlight.h"
+#include "line-map.h"
+#include "memory.h"
+#include "perf.h"
 #include "row-operations.h"
 
 extern struct EditorConfig E;
@@ -40,45 +53,157 @@ int editor_row_render_x_to_cursor_x(EditorRow *row, int rx) {
   return cx;
 }
 
-void editor_update_row(EditorRow *row) {
-  int tabs = 0;
+// Render kernel
 
-  for (int i = 0; i < row->size; i++) {
-    if (row->chars[i] == '\t') {
-      tabs++;
+#define RENDER_BLOCK 16
+
+// Bit i of the result is set if p[i] is a tab or a control byte, bit i of
+// tabs if it is a tab. Bytes past len are ignored.
+static unsigned render_scan_block(const char *p, int len, unsigned *tabs) {
+  char block[RENDER_BLOCK];
+  if (len < RENDER_BLOCK) {
+    memset(block, ' ', RENDER_BLOCK);
+    memcpy(block, p, len);
+    p = block;
+  }
+
+#ifdef __SSE2__
+  __m128i v = _mm_loadu_si128((const __m128i *)p);
+  __m128i below_space = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(31)),
+                                       _mm_set1_epi8(31));
+  __m128i del = _mm_cmpeq_epi8(v, _mm_set1_epi8(127));
+
+  *tabs = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+  return _mm_movemask_epi8(_mm_or_si128(below_space, del));
+#else
+  unsigned mask = 0;
+  *tabs = 0;
+
+  for (int i = 0; i < RENDER_BLOCK; i++) {
+    unsigned char c = p[i];
+    if (c < 32 || c == 127) {
+      mask |= 1u << i;
+    }
+    if (c == '\t') {
+      *tabs |= 1u << i;
     }
   }
 
-  free(row->r_chars);
-  row->r_chars = malloc(row->size + tabs * (KILO_TAB_STOP - 1) + 1);
+  return mask;
+#endif
+}
 
-  size_t idx = 0;
-  for (size_t j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      row->r_chars[idx++] = ' ';
+// Expands tabs into the render buffer and records where control bytes
+// land. Clean spans are copied whole. Doesn't touch E, so rows can be
+// rendered off the main thread.
+void editor_update_render(EditorRow *row) {
+  int tabs = 0;
+  int ctrls = 0;
 
-      while (idx % KILO_TAB_STOP != 0) {
-        row->r_chars[idx++] = ' ';
-      }
+  for (int i = 0; i < row->size; i += RENDER_BLOCK) {
+    unsigned tab_mask;
+    unsigned mask = render_scan_block(&row->chars[i], row->size - i, &tab_mask);
 
-      continue;
+    tabs += __builtin_popcount(tab_mask);
+    ctrls += __builtin_popcount(mask & ~tab_mask);
+  }
+
+  mem_free(row->r_chars);
+  row->r_chars =
+      mem_malloc(MEM_RENDER, row->size + tabs * (KILO_TAB_STOP - 1) + 1);
+
+  mem_free(row->r_ctrl);
+  row->r_ctrl = ctrls ? mem_malloc(MEM_RENDER, sizeof(int) * ctrls) : NULL;
+  row->r_num_ctrl = 0;
+
+  int idx = 0;
+  for (int i = 0; i < row->size; i += RENDER_BLOCK) {
+    unsigned tab_mask;
+    unsigned mask = render_scan_block(&row->chars[i], row->size - i, &tab_mask);
+
+    int len = row->size - i < RENDER_BLOCK ? row->size - i : RENDER_BLOCK;
+    int copied = 0;
+
+    while (mask) {
+      int at = __builtin_ctz(mask);
+      mask &= mask - 1;
+
+      memcpy(&row->r_chars[idx], &row->chars[i + copied], at - copied);
+      idx += at - copied;
+      copied = at + 1;
+
+      if (tab_mask & (1u << at)) {
+        int spaces = KILO_TAB_STOP - idx % KILO_TAB_STOP;
+        memset(&row->r_chars[idx], ' ', spaces);
+        idx += spaces;
+      } else {
+        row->r_ctrl[row->r_num_ctrl++] = idx;
+        row->r_chars[idx++] = row->chars[i + at];
+      }
     }
 
-    row->r_chars[idx++] = row->chars[j];
+    memcpy(&row->r_chars[idx], &row->chars[i + copied], len - copied);
+    idx += len - copied;
   }
 
   row->r_chars[idx] = '\0';
   row->r_size = idx;
+}
+
+// Stamps an edited row and records it in the dirty ranges
+static void editor_row_edited(EditorRow *row) {
+  E.dirty++;
+  row->version = ++E.version;
+
+  dirty_add(&E.dirty_since_save, row->idx, row->idx + 1);
+  dirty_add(&E.dirty_since_frame, row->idx, row->idx + 1);
+}
+
+void editor_update_row(EditorRow *row) {
+  // Kept past the redo so only the words the edit touched are reindexed
+  char *old = row->r_chars;
+  int old_size = row->r_size;
+  row->r_chars = NULL;
+
+  editor_update_render(row);
+  completion_row_changed(row, old, old_size);
+  mem_free(old);
+  line_map_row_changed(row->idx);
 
   editor_update_syntax(row);
 }
 
+// Fills a row put in the array at at, nothing derived from its text yet
+static void editor_init_row(int at, const char *s, size_t len) {
+  EditorRow *row = &E.row[at];
+
+  row->idx = at;
+
+  row->size = len;
+  row->chars = mem_malloc(MEM_ROW_TEXT, len + 1);
+  memcpy(row->chars, s, len);
+  row->chars[len] = '\0';
+
+  row->r_size = 0;
+  row->r_chars = NULL;
+  row->r_ctrl = NULL;
+  row->r_num_ctrl = 0;
+
+  row->hl = NULL;
+  row->hl_open_comment = 0;
+  row->brackets = NULL;
+  row->num_brackets = 0;
+  row->disk_offset = -1;
+}
+
 void editor_insert_row(int at, char *s, size_t len) {
   if (at < 0 || at > E.num_rows) {
     return;
   }
 
-  E.row = realloc(E.row, sizeof(EditorRow) * (E.num_rows + 1));
+  clipboard_rows_changing(at);
+  E.row = mem_realloc(MEM_ROW_INDEX, E.row,
+                      sizeof(EditorRow) * (E.num_rows + 1));
   memmove(&E.row[at + 1], &E.row[at], sizeof(EditorRow) * (E.num_rows - at));
 
   // Updating indexes
@@ -86,83 +211,276 @@ void editor_insert_row(int at, char *s, size_t len) {
     E.row[i].idx++;
   }
 
-  E.row[at].idx = at;
-
-  E.row[at].size = len;
-  E.row[at].chars = malloc(len + 1);
-  memcpy(E.row[at].chars, s, len);
-  E.row[at].chars[len] = '\0';
+  editor_init_row(at, s, len);
 
-  E.row[at].r_size = 0;
-  E.row[at].r_chars = NULL;
-
-  E.row[at].hl = NULL;
-  E.row[at].hl_open_comment = 0;
+  E.num_rows++;
+  highlight_rows_inserted(at, 1);
+  brackets_rows_inserted(at, 1);
+  line_map_rows_inserted(at, 1);
   editor_update_row(&E.row[at]);
 
-  E.num_rows++;
-  E.dirty++;
+  // Every row below shows up one line further down, the first row also
+  // replaces the welcome screen
+  dirty_shift(&E.dirty_since_save, at, 1);
+  dirty_add(&E.dirty_since_frame, at, E.num_rows == 1 ? INT_MAX : E.num_rows);
+  editor_row_edited(&E.row[at]);
 }
 
 void editor_free_row(EditorRow *row) {
-  free(row->r_chars);
-  free(row->chars);
-  free(row->hl);
+  mem_free(row->r_chars);
+  mem_free(row->r_ctrl);
+  mem_free(row->chars);
+  mem_free(row->hl);
+  mem_free(row->brackets);
+}
+
+// Batches touching this many rows and a good part of the file have the
+// words indexed again on a worker, like a file just opened, rather than
+// taken out and put back row by row
+#define ROWS_REINDEX_MIN 4096
+
+static int editor_batch_reindexes(int rows) {
+  return rows >= ROWS_REINDEX_MIN && rows >= E.num_rows / 4;
 }
 
-void editor_del_row(int at) {
-  if (at < 0 || at >= E.num_rows) {
+// Deletes count rows from at, moving the rows below only once
+void editor_del_rows(int at, int count) {
+  if (at < 0 || count <= 0 || at + count > E.num_rows) {
     return;
   }
 
-  editor_free_row(&E.row[at]);
-  memmove(&E.row[at], &E.row[at + 1],
-          sizeof(EditorRow) * (E.num_rows - at - 1));
+  clipboard_rows_changing(at);
+  int reindex = editor_batch_reindexes(count);
+  for (int i = at; i < at + count; i++) {
+    if (!reindex) {
+      completion_row_removed(&E.row[i]);
+    }
+    editor_free_row(&E.row[i]);
+  }
+  memmove(&E.row[at], &E.row[at + count],
+          sizeof(EditorRow) * (E.num_rows - at - count));
 
   // Reducing indexes
-  for (int j = at; j < E.num_rows - 1; j++) {
-    E.row[j].idx--;
+  for (int j = at; j < E.num_rows - count; j++) {
+    E.row[j].idx -= count;
   }
-  E.num_rows--;
+  E.num_rows -= count;
+  highlight_rows_deleted(at, count);
+  brackets_rows_deleted(at, count);
+  line_map_rows_deleted(at, count);
+
+  // The row that moved up into the gap now starts at a different offset
+  dirty_shift(&E.dirty_since_save, at, -count);
+  dirty_add(&E.dirty_since_save, at, at + 1);
+  dirty_add(&E.dirty_since_frame, at,
+            E.num_rows == 0 ? INT_MAX : E.num_rows + count);
+
   E.dirty++;
+  E.version++;
+
+  if (reindex) {
+    completion_index_rows();
+  }
 }
 
+void editor_del_row(int at) { editor_del_rows(at, 1); }
+
 void editor_row_insert_char(EditorRow *row, int at, int c) {
   if (at < 0 || at > row->size) {
     at = row->size;
   }
+  clipboard_rows_changing(row->idx);
 
-  row->chars = realloc(row->chars, row->size + 2);
+  row->chars = mem_realloc(MEM_ROW_TEXT, row->chars, row->size + 2);
   memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
   row->size++;
 
   row->chars[at] = c;
   editor_update_row(row);
+  editor_row_edited(row);
+}
 
-  E.dirty++;
+void editor_row_insert_string(EditorRow *row, int at, const char *s,
+                              size_t len) {
+  if (at < 0 || at > row->size) {
+    at = row->size;
+  }
+  clipboard_rows_changing(row->idx);
+
+  row->chars = mem_realloc(MEM_ROW_TEXT, row->chars, row->size + len + 1);
+  memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+  memcpy(&row->chars[at], s, len);
+  row->size += len;
+
+  editor_update_row(row);
+  editor_row_edited(row);
 }
 
 void editor_row_append_string(EditorRow *row, char *s, size_t len) {
-  row->chars = realloc(row->chars, row->size + len + 1);
+  clipboard_rows_changing(row->idx);
+  row->chars = mem_realloc(MEM_ROW_TEXT, row->chars, row->size + len + 1);
   memcpy(&row->chars[row->size], s, len);
 
   row->size += len;
   row->chars[row->size] = '\0';
   editor_update_row(row);
+  editor_row_edited(row);
+}
 
-  E.dirty++;
+void editor_row_truncate(EditorRow *row, int at) {
+  if (at < 0 || at >= row->size) {
+    return;
+  }
+  clipboard_rows_changing(row->idx);
+
+  row->size = at;
+  row->chars[at] = '\0';
+  editor_update_row(row);
+  editor_row_edited(row);
+}
+
+void editor_row_del_chars(EditorRow *row, int at, int len) {
+  if (at < 0 || len <= 0 || at + len > row->size) {
+    return;
+  }
+  clipboard_rows_changing(row->idx);
+
+  memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+  row->size -= len;
+
+  editor_update_row(row);
+  editor_row_edited(row);
 }
 
 void editor_row_del_char(EditorRow *row, int at) {
   if (at < 0 || at >= row->size) {
     return;
   }
+  clipboard_rows_changing(row->idx);
 
   memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
   row->size--;
   editor_update_row(row);
+  editor_row_edited(row);
+}
 
-  E.dirty++;
+// Batch edits
+
+static int editor_edit_lines(const struct RowEdit *edit) {
+  int lines = 1;
+  const char *p = edit->text;
+  const char *end = edit->text + edit->len;
+
+  while ((p = memchr(p, '\n', end - p)) != NULL) {
+    lines++;
+    p++;
+  }
+
+  return lines;
+}
+
+// Gives each row its new text in one pass, edits sorted by row. The texts
+// are taken over, a '\n' in one starts a new row below. Inserting those
+// one by one would move every row below each time, so the array is
+// widened once, the rows moved at most once, and what tracks rows below
+// the first new one marked stale rather than shifted row by row.
+void editor_rows_rewrite(struct RowEdit *edits, int count) {
+  if (count == 0) {
+    return;
+  }
+
+  clipboard_rows_changing(edits[0].row);
+  int added = 0;
+  for (int i = 0; i < count; i++) {
+    added += editor_edit_lines(&edits[i]) - 1;
+  }
+
+  if (added > 0) {
+    // Bottom up, the rows each call names haven't moved yet
+    for (int i = count - 1; i >= 0; i--) {
+      int extra = editor_edit_lines(&edits[i]) - 1;
+      if (extra > 0) {
+        highlight_rows_inserted(edits[i].row + 1, extra);
+        brackets_rows_inserted(edits[i].row + 1, extra);
+        line_map_rows_inserted(edits[i].row + 1, extra);
+      }
+    }
+
+    int first = edits[0].row + 1;
+    int old_rows = E.num_rows;
+
+    E.row = mem_realloc(MEM_ROW_INDEX, E.row,
+                        sizeof(EditorRow) * (old_rows + added));
+
+    // Each run of rows between two edits moves down by the rows the
+    // edits above it add
+    int shift = added;
+    int end = old_rows;
+    for (int i = count - 1; i >= 0 && shift > 0; i--) {
+      int at = edits[i].row + 1;
+      memmove(&E.row[at + shift], &E.row[at],
+              sizeof(EditorRow) * (end - at));
+
+      int extra = editor_edit_lines(&edits[i]) - 1;
+      shift -= extra;
+      for (int j = 0; j < extra; j++) {
+        editor_init_row(at + shift + j, "", 0);
+      }
+
+      end = at;
+    }
+
+    E.num_rows += added;
+    for (int i = first; i < E.num_rows; i++) {
+      E.row[i].idx = i;
+    }
+
+    dirty_shift(&E.dirty_since_save, first, added);
+    dirty_add(&E.dirty_since_save, first, E.num_rows);
+    dirty_add(&E.dirty_since_frame, first, INT_MAX);
+  }
+
+  int reindex = editor_batch_reindexes(count + added);
+
+  int shift = 0;
+  for (int i = 0; i < count; i++) {
+    int at = edits[i].row + shift;
+    const char *line = edits[i].text;
+    const char *end = edits[i].text + edits[i].len;
+
+    while (1) {
+      const char *newline = memchr(line, '\n', end - line);
+      size_t len = (newline ? newline : end) - line;
+
+      EditorRow *row = &E.row[at];
+      row->chars = mem_realloc(MEM_ROW_TEXT, row->chars, len + 1);
+      memcpy(row->chars, line, len);
+      row->chars[len] = '\0';
+      row->size = len;
+
+      if (reindex) {
+        editor_update_render(row);
+        line_map_row_changed(row->idx);
+        editor_update_syntax(row);
+      } else {
+        editor_update_row(row);
+      }
+      editor_row_edited(row);
+
+      if (newline == NULL) {
+        break;
+      }
+      line = newline + 1;
+      at++;
+      shift++;
+    }
+
+    mem_free(edits[i].text);
+  }
+
+  if (reindex) {
+    completion_index_rows();
+  }
 }
 
 // Filetypes
@@ -195,12 +513,16 @@ int is_separator(int c) {
   return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
 }
 
-void editor_update_syntax(EditorRow *row) {
-  row->hl = realloc(row->hl, row->r_size);
+// Highlights a row that starts inside a multiline comment if in_comment is
+// set and returns whether it ends inside one. Only reads E.syntax.
+int editor_highlight_row(EditorRow *row, int in_comment) {
+  row->hl = mem_realloc(MEM_HIGHLIGHT, row->hl, row->r_size);
   memset(row->hl, HL_NORMAL, row->r_size);
 
   if (E.syntax == NULL)
-    return;
+    return 0;
+
+  perf_count_rehighlight();
 
   char **keywords = E.syntax->keywords;
 
@@ -215,7 +537,6 @@ void editor_update_syntax(EditorRow *row) {
 
   int prev_sep = 1;
   int in_string = 0;
-  int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
 
   for (int i = 0; i < row->r_size; i++) {
     char c = row->r_chars[i];
@@ -317,10 +638,24 @@ void editor_update_syntax(EditorRow *row) {
     prev_sep = is_separator(c);
   }
 
+  return in_comment;
+}
+
+void editor_update_syntax(EditorRow *row) {
+  uint64_t trace_start = perf_trace_begin();
+
+  int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
+  in_comment = editor_highlight_row(row, in_comment);
+
   int changed = (row->hl_open_comment != in_comment);
   row->hl_open_comment = in_comment;
-  if (changed && row->idx + 1 < E.num_rows)
-    editor_update_syntax(&E.row[row->idx + 1]);
+  brackets_rows_changed(row->idx, row->idx + 1);
+
+  perf_trace_end("editor_update_syntax", trace_start);
+
+  // The rows below are lexed in slices between keys, see highlight_run
+  if (changed)
+    highlight_schedule(row->idx + 1);
 }
 
 const char *TEXT_RESET = "\x1b[39m";
@@ -374,10 +709,7 @@ void editor_select_syntax_highlight(void) {
 
       if ((is_ext && ext_match) || (!is_ext && filename_contain_pattern)) {
         E.syntax = s;
-
-        for (size_t file_row = 0; file_row < E.num_rows; file_row++) {
-          editor_update_syntax(&E.row[file_row]);
-        }
+        editor_highlight_from(0);
 
         return;
       }
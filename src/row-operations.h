@@ -5,14 +5,29 @@
 
 int editor_row_cursor_x_to_render_x(EditorRow *row, int cx);
 int editor_row_render_x_to_cursor_x(EditorRow *row, int rx);
+void editor_update_render(EditorRow *row);
 void editor_update_row(EditorRow *row);
 void editor_insert_row(int at, char *s, size_t len);
 void editor_free_row(EditorRow *row);
 void editor_del_row(int at);
+void editor_del_rows(int at, int count);
 void editor_row_insert_char(EditorRow *row, int at, int c);
+void editor_row_insert_string(EditorRow *row, int at, const char *s,
+                              size_t len);
 void editor_row_append_string(EditorRow *row, char *s, size_t len);
+void editor_row_truncate(EditorRow *row, int at);
+void editor_row_del_chars(EditorRow *row, int at, int len);
 void editor_row_del_char(EditorRow *row, int at);
 
+// New text for a row, split into several at '\n'
+struct RowEdit {
+  int row;
+  char *text;
+  size_t len;
+};
+
+void editor_rows_rewrite(struct RowEdit *edits, int count);
+
 // Syntax Hightlight
 
 #define HL_HIGHLIGHT_NUMBERS (1 << 0)
@@ -40,6 +55,7 @@ extern const char *TEXT_BLUE;
 extern const char *TEXT_MAGENTA;
 extern const char *TEXT_CYAN;
 
+int editor_highlight_row(EditorRow *row, int in_comment);
 void editor_update_syntax(EditorRow *row);
 const char *editor_syntax_to_color(int hl);
 void editor_select_syntax_highlight(void);
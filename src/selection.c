@@ -0,0 +1,108 @@
+#include <limits.h>
+
+#include "dirty.h"
+#include "editor-io.h"
+#include "editor.h"
+#include "row-operations.h"
+#include "selection.h"
+
+extern struct EditorConfig E;
+
+static enum SelectionMode mode = SELECT_NONE;
+static int anchor_x = 0;
+static int anchor_y = 0;
+
+// The selection when last drawn
+static struct Selection drawn;
+
+static int selection_render_x(int row, int x) {
+  return row < E.num_rows ? editor_row_cursor_x_to_render_x(&E.row[row], x)
+                          : 0;
+}
+
+// Returns 0 if nothing is selected
+int selection_get(struct Selection *sel) {
+  *sel = (struct Selection){.mode = mode};
+  if (mode == SELECT_NONE) {
+    return 0;
+  }
+
+  // The anchor may be left past rows or text deleted since
+  int ay = anchor_y < E.num_rows ? anchor_y : E.num_rows;
+  int ax = ay < E.num_rows && anchor_x <= E.row[ay].size ? anchor_x : 0;
+
+  int anchor_first = ay < E.cursor_y || (ay == E.cursor_y && ax < E.cursor_x);
+  sel->top = anchor_first ? ay : E.cursor_y;
+  sel->top_x = anchor_first ? ax : E.cursor_x;
+  sel->bottom = anchor_first ? E.cursor_y : ay;
+  sel->bottom_x = anchor_first ? E.cursor_x : ax;
+
+  if (mode == SELECT_BLOCK) {
+    int a = selection_render_x(ay, ax);
+    int b = selection_render_x(E.cursor_y, E.cursor_x);
+    sel->left = a < b ? a : b;
+    sel->right = a < b ? b : a;
+  }
+
+  return 1;
+}
+
+// Render columns of row that are selected, from start_rx up to end_rx.
+// Returns 0 if there are none.
+int selection_span(int row, int *start_rx, int *end_rx) {
+  if (drawn.mode == SELECT_NONE || row < drawn.top || row > drawn.bottom ||
+      row >= E.num_rows) {
+    return 0;
+  }
+
+  if (drawn.mode == SELECT_BLOCK) {
+    *start_rx = drawn.left;
+    *end_rx = drawn.right;
+  } else {
+    *start_rx = row == drawn.top ? selection_render_x(row, drawn.top_x) : 0;
+    *end_rx = row == drawn.bottom ? selection_render_x(row, drawn.bottom_x)
+                                  : INT_MAX;
+  }
+
+  return *start_rx < *end_rx;
+}
+
+// Called before every frame, redraws the rows whose part in the selection
+// may have changed since the last one
+void selection_track(void) {
+  struct Selection sel;
+  selection_get(&sel);
+
+  if (sel.mode == drawn.mode && sel.top == drawn.top &&
+      sel.bottom == drawn.bottom && sel.top_x == drawn.top_x &&
+      sel.bottom_x == drawn.bottom_x && sel.left == drawn.left &&
+      sel.right == drawn.right) {
+    return;
+  }
+
+  if (drawn.mode != SELECT_NONE) {
+    dirty_add(&E.dirty_since_frame, drawn.top, drawn.bottom + 1);
+  }
+  if (sel.mode != SELECT_NONE) {
+    dirty_add(&E.dirty_since_frame, sel.top, sel.bottom + 1);
+  }
+  drawn = sel;
+}
+
+void selection_clear(void) { mode = SELECT_NONE; }
+
+// Cycles through selecting lines, a block and nothing, from the cursor
+void editor_toggle_selection(void) {
+  if (mode == SELECT_NONE) {
+    anchor_x = E.cursor_x;
+    anchor_y = E.cursor_y;
+  }
+
+  mode = mode == SELECT_NONE   ? SELECT_LINES
+         : mode == SELECT_LINES ? SELECT_BLOCK
+                                : SELECT_NONE;
+
+  editor_set_status_message(mode == SELECT_LINES   ? "Selecting lines"
+                            : mode == SELECT_BLOCK ? "Selecting a block"
+                                                   : "");
+}
@@ -0,0 +1,34 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+// Text between a fixed anchor and the cursor, either every character in
+// reading order or a rectangle of render columns
+
+enum SelectionMode {
+  SELECT_NONE = 0,
+  SELECT_LINES,
+  SELECT_BLOCK,
+};
+
+// Selected text, from top to bottom. Lines selections run from top_x to
+// bottom_x, cursor positions. Blocks take the render columns from left up
+// to right of every row between top and bottom, both included.
+struct Selection {
+  enum SelectionMode mode;
+  int top;
+  int bottom;
+
+  int top_x;
+  int bottom_x;
+
+  int left;
+  int right;
+};
+
+int selection_get(struct Selection *sel);
+int selection_span(int row, int *start_rx, int *end_rx);
+void selection_track(void);
+void selection_clear(void);
+void editor_toggle_selection(void);
+
+#endif // SELECTION_H
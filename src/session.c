@@ -0,0 +1,384 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "editor.h"
+#include "highlight.h"
+#include "loader.h"
+#include "memory.h"
+#include "session.h"
+
+extern struct EditorConfig E;
+
+#define SESSION_MAGIC "KILOSES1"
+#define SESSION_MAGIC_LEN 8
+
+// Files up to this size are hashed whole, bigger ones by samples
+#define SESSION_HASH_WHOLE (1 << 20)
+#define SESSION_HASH_SAMPLES 64
+#define SESSION_HASH_SAMPLE_LEN 4096
+
+// Layout, in host byte order: the header, the file's path, then one bit per
+// row set if the row ends inside a multiline comment
+struct SessionHeader {
+  char magic[SESSION_MAGIC_LEN];
+  uint64_t size;
+  int64_t mtime;
+  int64_t mtime_nsec;
+  uint64_t fingerprint;
+
+  int32_t num_rows;
+  int32_t cursor_x;
+  int32_t cursor_y;
+  int32_t row_off;
+  int32_t col_off;
+  int32_t path_len;
+};
+
+static uint64_t session_hash(uint64_t hash, const void *data, size_t len) {
+  const unsigned char *p = data;
+
+  for (size_t i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 1099511628211ull;
+  }
+
+  return hash;
+}
+
+// Hashes small files whole and big ones at evenly spread samples that take
+// in both ends, so checking a file costs the same whatever its size. The
+// size and mtime catch what the samples miss.
+static int session_fingerprint(int fd, off_t size, uint64_t *fingerprint) {
+  size_t len = size < SESSION_HASH_WHOLE ? size : SESSION_HASH_SAMPLE_LEN;
+  int samples = size < SESSION_HASH_WHOLE ? 1 : SESSION_HASH_SAMPLES;
+
+  char *buf = mem_malloc(MEM_FILE_IO, len ? len : 1);
+  uint64_t hash = 14695981039346656037ull;
+
+  for (int i = 0; i < samples; i++) {
+    off_t offset = samples == 1 ? 0 : (size - len) / (samples - 1) * i;
+
+    size_t done = 0;
+    while (done < len) {
+      ssize_t n = pread(fd, &buf[done], len - done, offset + done);
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        mem_free(buf);
+        return -1;
+      }
+      done += n;
+    }
+
+    hash = session_hash(hash, buf, len);
+  }
+
+  mem_free(buf);
+  *fingerprint = hash;
+  return 0;
+}
+
+// $XDG_CACHE_HOME/kilo/<hash of the absolute path>, created on the way if
+// create is set
+static char *session_path(const char *real_path, int create) {
+  char dir[PATH_MAX];
+  const char *cache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+
+  if (cache && cache[0]) {
+    snprintf(dir, sizeof(dir), "%s", cache);
+  } else if (home && home[0]) {
+    snprintf(dir, sizeof(dir), "%s/.cache", home);
+  } else {
+    return NULL;
+  }
+
+  if (create) {
+    mkdir(dir, 0700);
+  }
+  strncat(dir, "/kilo", sizeof(dir) - strlen(dir) - 1);
+  if (create) {
+    mkdir(dir, 0700);
+  }
+
+  uint64_t hash =
+      session_hash(14695981039346656037ull, real_path, strlen(real_path));
+
+  size_t len = strlen(dir) + 18;
+  char *path = mem_malloc(MEM_FILE_IO, len);
+  snprintf(path, len, "%s/%016llx", dir, (unsigned long long)hash);
+  return path;
+}
+
+static int read_all(int fd, void *data, size_t len) {
+  char *p = data;
+
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+  const char *p = data;
+
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+// Header of the session stored for E.filename, if it was saved for the file
+// exactly as it is now on fd. Leaves the cache file open past the path.
+static int session_open(int fd, struct SessionHeader *header) {
+  struct stat st;
+  char real_path[PATH_MAX];
+
+  if (E.filename == NULL || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+      realpath(E.filename, real_path) == NULL) {
+    return -1;
+  }
+
+  char *path = session_path(real_path, 0);
+  if (path == NULL) {
+    return -1;
+  }
+
+  int cache_fd = open(path, O_RDONLY);
+  mem_free(path);
+  if (cache_fd == -1) {
+    return -1;
+  }
+
+  size_t path_len = strlen(real_path);
+  char stored_path[PATH_MAX];
+  uint64_t fingerprint;
+
+  if (read_all(cache_fd, header, sizeof(*header)) == -1 ||
+      memcmp(header->magic, SESSION_MAGIC, SESSION_MAGIC_LEN) != 0 ||
+      header->path_len != (int32_t)path_len ||
+      read_all(cache_fd, stored_path, path_len) == -1 ||
+      memcmp(stored_path, real_path, path_len) != 0 ||
+      header->size != (uint64_t)st.st_size ||
+      header->mtime != st.st_mtim.tv_sec ||
+      header->mtime_nsec != st.st_mtim.tv_nsec ||
+      session_fingerprint(fd, st.st_size, &fingerprint) == -1 ||
+      header->fingerprint != fingerprint) {
+    close(cache_fd);
+    return -1;
+  }
+
+  return cache_fd;
+}
+
+// Session of the file being loaded, until its rows are all in
+static struct SessionHeader restoring;
+static unsigned char *restoring_bits = NULL;
+static int position_pending = 0;
+static int restoring_wrong = 0;
+
+static void session_drop(void) {
+  mem_free(restoring_bits);
+  restoring_bits = NULL;
+  position_pending = 0;
+}
+
+// Checks for a session of the file about to be loaded from fd. Its rows
+// then take the comment state they were saved with as they arrive, and
+// are only lexed once they are needed. Returns whether there is one.
+int session_begin(int fd) {
+  session_drop();
+  restoring_wrong = 0;
+
+  int cache_fd = session_open(fd, &restoring);
+  if (cache_fd == -1 || restoring.num_rows < 0) {
+    if (cache_fd != -1) {
+      close(cache_fd);
+    }
+    return 0;
+  }
+
+  size_t bits_len = ((size_t)restoring.num_rows + 7) / 8;
+  restoring_bits = mem_malloc(MEM_FILE_IO, bits_len ? bits_len : 1);
+
+  int ok = read_all(cache_fd, restoring_bits, bits_len) == 0;
+  close(cache_fd);
+
+  if (!ok) {
+    session_drop();
+    return 0;
+  }
+
+  position_pending = 1;
+  return 1;
+}
+
+// Puts the cursor back where it was, unless it has moved since opening
+static void session_restore_position(void) {
+  position_pending = 0;
+  if (E.cursor_x != 0 || E.cursor_y != 0 || E.row_off != 0) {
+    return;
+  }
+
+  E.cursor_y = restoring.cursor_y >= 0 && restoring.cursor_y <= E.num_rows
+                   ? restoring.cursor_y
+                   : 0;
+  E.cursor_x = E.cursor_y < E.num_rows && restoring.cursor_x >= 0 &&
+                       restoring.cursor_x <= E.row[E.cursor_y].size
+                   ? restoring.cursor_x
+                   : 0;
+  E.row_off = restoring.row_off >= 0 && restoring.row_off <= E.num_rows
+                  ? restoring.row_off
+                  : 0;
+  E.col_off = restoring.col_off >= 0 ? restoring.col_off : 0;
+}
+
+// Gives rows just loaded their stored states. Returns 0 when they have to be
+// lexed instead: there is no session, or an edit made while loading may
+// have changed the state they start in.
+int session_rows_loaded(int first, int count) {
+  if (restoring_bits == NULL) {
+    return 0;
+  }
+  if (E.dirty || first + count > restoring.num_rows) {
+    restoring_wrong = first + count > restoring.num_rows;
+    session_drop();
+    return 0;
+  }
+
+  for (int i = first; i < first + count; i++) {
+    E.row[i].hl_open_comment = (restoring_bits[i / 8] >> (i % 8)) & 1;
+  }
+  highlight_defer_from(first);
+
+  if (position_pending && E.num_rows > restoring.cursor_y &&
+      E.num_rows > restoring.row_off) {
+    session_restore_position();
+  }
+
+  return 1;
+}
+
+// Called once the file is loaded. Returns 0 if it didn't end up with the
+// rows the session was saved for, whose states then can't be trusted.
+int session_end(void) {
+  if (restoring_bits == NULL) {
+    return !restoring_wrong;
+  }
+
+  int ok = E.num_rows == restoring.num_rows;
+  if (ok && position_pending) {
+    session_restore_position();
+  }
+
+  session_drop();
+  return ok;
+}
+
+// Stores the session of a file with no unsaved changes. The rows must hold
+// what is on disk for their comment states to be of any use next time.
+void session_save(void) {
+  struct stat st;
+  char real_path[PATH_MAX];
+
+  if (E.filename == NULL || E.dirty || loader_active() ||
+      realpath(E.filename, real_path) == NULL) {
+    return;
+  }
+
+  int fd = open(real_path, O_RDONLY);
+  if (fd == -1) {
+    return;
+  }
+
+  uint64_t fingerprint;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+      st.st_size != E.disk_size || st.st_mtim.tv_sec != E.disk_mtime ||
+      st.st_mtim.tv_nsec != E.disk_mtime_nsec ||
+      session_fingerprint(fd, st.st_size, &fingerprint) == -1) {
+    close(fd);
+    return;
+  }
+  close(fd);
+
+  // Rows below an edit may still wait for their new state
+  highlight_settle();
+
+  struct SessionHeader header = {
+      .size = st.st_size,
+      .mtime = st.st_mtim.tv_sec,
+      .mtime_nsec = st.st_mtim.tv_nsec,
+      .fingerprint = fingerprint,
+      .num_rows = E.num_rows,
+      .cursor_x = E.cursor_x,
+      .cursor_y = E.cursor_y,
+      .row_off = E.row_off,
+      .col_off = E.col_off,
+      .path_len = strlen(real_path),
+  };
+  memcpy(header.magic, SESSION_MAGIC, SESSION_MAGIC_LEN);
+
+  size_t bits_len = ((size_t)E.num_rows + 7) / 8;
+  unsigned char *bits = mem_malloc(MEM_FILE_IO, bits_len ? bits_len : 1);
+  memset(bits, 0, bits_len);
+  for (int i = 0; i < E.num_rows; i++) {
+    bits[i / 8] |= (E.row[i].hl_open_comment != 0) << (i % 8);
+  }
+
+  char *path = session_path(real_path, 1);
+  if (path == NULL) {
+    mem_free(bits);
+    return;
+  }
+
+  // Written aside and renamed over, a reader never sees half a session
+  size_t tmp_len = strlen(path) + 5;
+  char *tmp_path = mem_malloc(MEM_FILE_IO, tmp_len);
+  snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+  int cache_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (cache_fd != -1) {
+    int ok = write_all(cache_fd, &header, sizeof(header)) == 0 &&
+             write_all(cache_fd, real_path, header.path_len) == 0 &&
+             write_all(cache_fd, bits, bits_len) == 0;
+    close(cache_fd);
+
+    if (!ok || rename(tmp_path, path) == -1) {
+      unlink(tmp_path);
+    }
+  }
+
+  mem_free(tmp_path);
+  mem_free(path);
+  mem_free(bits);
+}
@@ -0,0 +1,13 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+// Per-file sessions cached under $XDG_CACHE_HOME/kilo: the cursor, the
+// scroll offsets and the comment state every row ends in, kept for as long
+// as the file doesn't change
+
+int session_begin(int fd);
+int session_rows_loaded(int first, int count);
+int session_end(void);
+void session_save(void);
+
+#endif // SESSION_H
@@ -1,6 +1,9 @@
 #include "terminal.h"
+#include "editor-io.h"
 #include "editor.h"
+#include "perf.h"
 #include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
@@ -109,11 +112,16 @@ int handle_o_sequences(char seq[]) {
 int editor_read_key(void) {
   int nread;
   char c;
+
+  editor_idle();
   while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
     if (nread == -1 && errno != EAGAIN) {
       die("read");
     }
+
+    editor_idle();
   }
+  perf_key_pressed();
 
   if (c == ESC_KEY) {
     char seq[3];
@@ -177,3 +185,28 @@ int get_window_size(uint16_t *rows, uint16_t *cols) {
 
   return 0;
 }
+
+// Picks up a new terminal size, returns whether it changed
+int terminal_resized(void) {
+  struct winsize ws;
+
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0 ||
+      ws.ws_row < 3) {
+    return 0;
+  }
+  if (ws.ws_row - 2 == E.screen_rows && ws.ws_col == E.screen_cols) {
+    return 0;
+  }
+
+  // Room for the status and message bars
+  E.screen_rows = ws.ws_row - 2;
+  E.screen_cols = ws.ws_col;
+
+  return 1;
+}
+
+// Whether a key is waiting to be read, without blocking
+int terminal_input_pending(void) {
+  struct pollfd fd = {.fd = STDIN_FILENO, .events = POLLIN};
+  return poll(&fd, 1, 0) > 0;
+}
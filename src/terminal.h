@@ -11,6 +11,8 @@ int read_escape_sequence(char *seq, int length);
 int handle_bracket_sequences(char seq[]);
 int handle_o_sequences(char seq[]);
 int editor_read_key(void);
+int terminal_resized(void);
+int terminal_input_pending(void);
 int get_cursor_position(uint16_t *rows, uint16_t *cols);
 int get_window_size(uint16_t *rows, uint16_t *cols);
 
@@ -0,0 +1,197 @@
+#include "treap.h"
+#include "memory.h"
+
+int treap_size(struct Treap *tree, int t) {
+  return t ? tree->nodes[t].size : 0;
+}
+
+static void treap_pull(struct Treap *tree, int t) {
+  struct TreapNode *n = &tree->nodes[t];
+
+  n->size = 1;
+  if (n->left) {
+    n->size += tree->nodes[n->left].size;
+    tree->nodes[n->left].parent = t;
+  }
+  if (n->right) {
+    n->size += tree->nodes[n->right].size;
+    tree->nodes[n->right].parent = t;
+  }
+
+  tree->pull(t);
+}
+
+static void treap_push(struct Treap *tree, int t) {
+  if (tree->push) {
+    tree->push(t);
+  }
+}
+
+int treap_new_node(struct Treap *tree) {
+  int t = tree->free_nodes;
+  if (t != 0) {
+    tree->free_nodes = tree->nodes[t].left;
+  } else {
+    if (tree->num_nodes >= tree->cap_nodes) {
+      tree->cap_nodes = tree->cap_nodes ? tree->cap_nodes * 2 : 1024;
+      tree->nodes = mem_realloc(tree->tag, tree->nodes,
+                                sizeof(struct TreapNode) * tree->cap_nodes);
+      tree->nodes[0] = (struct TreapNode){0};
+      tree->grow(tree->cap_nodes);
+    }
+    t = tree->num_nodes++;
+  }
+
+  tree->seed ^= tree->seed << 13;
+  tree->seed ^= tree->seed >> 17;
+  tree->seed ^= tree->seed << 5;
+
+  tree->nodes[t] = (struct TreapNode){.priority = tree->seed, .size = 1};
+  return t;
+}
+
+void treap_free_tree(struct Treap *tree, int t) {
+  if (t == 0) {
+    return;
+  }
+
+  treap_free_tree(tree, tree->nodes[t].left);
+  treap_free_tree(tree, tree->nodes[t].right);
+  tree->nodes[t].left = tree->free_nodes;
+  tree->free_nodes = t;
+}
+
+// Splits t into its first k rows and the rest
+void treap_split(struct Treap *tree, int t, int k, int *a, int *b) {
+  if (t == 0) {
+    *a = *b = 0;
+    return;
+  }
+
+  struct TreapNode *n = &tree->nodes[t];
+  treap_push(tree, t);
+
+  int left = treap_size(tree, n->left);
+  if (left < k) {
+    treap_split(tree, n->right, k - left - 1, &n->right, b);
+    *a = t;
+  } else {
+    treap_split(tree, n->left, k, a, &n->left);
+    *b = t;
+  }
+  treap_pull(tree, t);
+}
+
+// The rows of a followed by those of b
+int treap_merge(struct Treap *tree, int a, int b) {
+  if (a == 0 || b == 0) {
+    return a ? a : b;
+  }
+
+  if (tree->nodes[a].priority > tree->nodes[b].priority) {
+    treap_push(tree, a);
+    tree->nodes[a].right = treap_merge(tree, tree->nodes[a].right, b);
+    treap_pull(tree, a);
+    return a;
+  }
+
+  treap_push(tree, b);
+  tree->nodes[b].left = treap_merge(tree, a, tree->nodes[b].left);
+  treap_pull(tree, b);
+  return b;
+}
+
+static int treap_build_from(struct Treap *tree, int first, int count,
+                            TreapFillFn fill, void *arg) {
+  if (count == 0) {
+    return 0;
+  }
+
+  int mid = count / 2;
+  int t = treap_new_node(tree);
+  int left = treap_build_from(tree, first, mid, fill, arg);
+  int right =
+      treap_build_from(tree, first + mid + 1, count - mid - 1, fill, arg);
+
+  tree->nodes[t].left = left;
+  tree->nodes[t].right = right;
+  fill(t, first + mid, arg);
+
+  // Sifting the priority down makes the balanced tree a heap by priority
+  // too, the way a binary heap is built
+  for (int n = t;;) {
+    int l = tree->nodes[n].left;
+    int r = tree->nodes[n].right;
+    int top = n;
+    if (l && tree->nodes[l].priority > tree->nodes[top].priority) {
+      top = l;
+    }
+    if (r && tree->nodes[r].priority > tree->nodes[top].priority) {
+      top = r;
+    }
+    if (top == n) {
+      break;
+    }
+
+    unsigned priority = tree->nodes[n].priority;
+    tree->nodes[n].priority = tree->nodes[top].priority;
+    tree->nodes[top].priority = priority;
+    n = top;
+  }
+
+  treap_pull(tree, t);
+  return t;
+}
+
+// Tree of count new rows, built balanced in O(count)
+int treap_build(struct Treap *tree, int count, TreapFillFn fill, void *arg) {
+  return treap_build_from(tree, 0, count, fill, arg);
+}
+
+void treap_set_root(struct Treap *tree, int t) {
+  tree->root = t;
+  if (t) {
+    tree->nodes[t].parent = 0;
+  }
+}
+
+// Node of the row at, 0 past the last one
+int treap_node_at(struct Treap *tree, int at) {
+  int t = tree->root;
+
+  while (t) {
+    int left = treap_size(tree, tree->nodes[t].left);
+    if (at == left) {
+      break;
+    }
+    if (at < left) {
+      t = tree->nodes[t].left;
+    } else {
+      at -= left + 1;
+      t = tree->nodes[t].right;
+    }
+  }
+
+  return t;
+}
+
+// Row of node t
+int treap_position(struct Treap *tree, int t) {
+  int at = treap_size(tree, tree->nodes[t].left);
+
+  for (; tree->nodes[t].parent; t = tree->nodes[t].parent) {
+    int up = tree->nodes[t].parent;
+    if (tree->nodes[up].right == t) {
+      at += treap_size(tree, tree->nodes[up].left) + 1;
+    }
+  }
+
+  return at;
+}
+
+// Redoes the sums of t and the nodes above it after t's own changed
+void treap_pull_up(struct Treap *tree, int t) {
+  for (; t; t = tree->nodes[t].parent) {
+    treap_pull(tree, t);
+  }
+}
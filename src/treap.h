@@ -0,0 +1,55 @@
+#ifndef TREAP_H
+#define TREAP_H
+
+#include "memory.h"
+
+// Rows in order as a treap balanced by random priorities. A node knows how
+// many rows its subtree holds rather than which rows, so rows inserted or
+// deleted anywhere only touch the nodes above them. What a node says about
+// its rows is kept by the tree's user in an array of its own, indexed like
+// the nodes, and summed up by its hooks.
+
+struct TreapNode {
+  int left;
+  int right;
+  int parent;
+  unsigned priority;
+  int size;
+};
+
+// Node 0 is the empty tree, the others are handed out from a free list.
+// num_nodes starts at 1 and seed anywhere but 0.
+struct Treap {
+  struct TreapNode *nodes;
+  int num_nodes;
+  int cap_nodes;
+  int free_nodes;
+  unsigned seed;
+  int root;
+  enum memTag tag;
+
+  // pull redoes node t's sums from its own and its children's. push, if
+  // set, hands down what t still owes its children before they change.
+  // grow is told the number of nodes the pool now has room for.
+  void (*pull)(int t);
+  void (*push)(int t);
+  void (*grow)(int cap);
+};
+
+// Gives node t the i-th of the rows being built
+typedef void (*TreapFillFn)(int t, int i, void *arg);
+
+int treap_size(struct Treap *tree, int t);
+int treap_new_node(struct Treap *tree);
+void treap_free_tree(struct Treap *tree, int t);
+
+void treap_split(struct Treap *tree, int t, int k, int *a, int *b);
+int treap_merge(struct Treap *tree, int a, int b);
+int treap_build(struct Treap *tree, int count, TreapFillFn fill, void *arg);
+void treap_set_root(struct Treap *tree, int t);
+
+int treap_node_at(struct Treap *tree, int at);
+int treap_position(struct Treap *tree, int t);
+void treap_pull_up(struct Treap *tree, int t);
+
+#endif // TREAP_H